@@ -0,0 +1,1209 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2016, 2017, 2018, 2019, 2020 (c)
+ *
+ *    file: astcache.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cmd.h"
+#include "astcache.h"
+#include "parser/parser.h"
+#include "builtins/setx.h"
+#include "debug.h"
+
+/* bits for the parser state we save in cache files (see parser_state()) */
+#define STATE_POSIX             (1 << 0)    /* the --posix option is set */
+#define STATE_ALIASES           (1 << 1)    /* the parser substitutes aliases */
+
+/* the writer of the file we are parsing now, NULL if we aren't caching it */
+struct ast_cache_writer_s *cur_ast_cache_writer = NULL;
+
+/* the in-memory cache of parsed dot files */
+struct source_cache_s source_cache = { NULL, 0, 0, 0, 0 };
+
+
+/*
+ * Check if we can cache the commands of the given input source (on disk or in
+ * memory). We only cache regular files that we've read in full via read_file().
+ * We don't cache in restricted shells, nor when the -v or savehist options are
+ * set, as these need the text of each command we execute.
+ *
+ * Returns 1 if we can cache the input source, 0 otherwise.
+ */
+static int ast_cache_usable(struct source_s *src)
+{
+    if(option_set('r') || option_set('v') || optionx_set(OPTION_SAVE_HIST))
+    {
+        return 0;
+    }
+
+    if(src->srctype != SOURCE_EXTERNAL_FILE && src->srctype != SOURCE_DOTFILE)
+    {
+        return 0;
+    }
+
+    return src->buftype != SOURCE_BUF_STREAM && src->srcname &&
+           S_ISREG(src->filestat.st_mode);
+}
+
+
+/*
+ * Return the bits of the shell's state that affect the way files are parsed.
+ * A cached file can only be used if it was parsed in the same state.
+ */
+static uint32_t parser_state(void)
+{
+    uint32_t state = 0;
+    if(option_set('P'))
+    {
+        state |= STATE_POSIX;
+    }
+    if(interactive_shell || optionx_set(OPTION_EXPAND_ALIASES))
+    {
+        state |= STATE_ALIASES;
+    }
+    return state;
+}
+
+
+/*
+ * Create the given directory and any missing parent directories.
+ *
+ * Returns 1 if the directory exists (or was created), 0 otherwise.
+ */
+static int make_cache_dir(char *dir)
+{
+    if(mkdir(dir, 0700) == 0 || errno == EEXIST)
+    {
+        return 1;
+    }
+
+    char *p = strrchr(dir, '/');
+    if(errno != ENOENT || !p || p == dir)
+    {
+        return 0;
+    }
+
+    /* create the parent directory, then try again */
+    *p = '\0';
+    int res = make_cache_dir(dir);
+    *p = '/';
+    return res && (mkdir(dir, 0700) == 0 || errno == EEXIST);
+}
+
+
+/*
+ * Get the pathname of the cache file we use for the script file with the given
+ * absolute path. Cache files live in $XDG_CACHE_HOME/lsh, or ~/.cache/lsh if
+ * $XDG_CACHE_HOME is not set. If create_dir is non-zero, the cache directory is
+ * created if it doesn't exist.
+ *
+ * Returns the malloc'd pathname, or NULL if we can't get the cache directory.
+ */
+static char *cache_file_path(char *path, int create_dir)
+{
+    char *dir = get_shell_varp("XDG_CACHE_HOME", NULL);
+    char *subdir = "lsh";
+
+    /* the XDG spec says we should ignore relative paths */
+    if(!dir || *dir != '/')
+    {
+        dir = get_shell_varp("HOME", NULL);
+        subdir = ".cache/lsh";
+        if(!dir || *dir != '/')
+        {
+            return NULL;
+        }
+    }
+
+    char *file = malloc(strlen(dir)+strlen(subdir)+16);
+    if(!file)
+    {
+        return NULL;
+    }
+    sprintf(file, "%s/%s", dir, subdir);
+
+    if(create_dir && !make_cache_dir(file))
+    {
+        free(file);
+        return NULL;
+    }
+
+    /* we check the full path when we load the file, in case of hash collisions */
+    sprintf(file+strlen(file), "/%08x.ast", calc_hash(path));
+    return file;
+}
+
+
+/*
+ * Copy n bytes from *p to dest (if dest is not NULL), and advance *p past them.
+ *
+ * Returns 1 if the bytes are within the cache file, 0 otherwise.
+ */
+static inline int get_bytes(char **p, char *end, void *dest, size_t n)
+{
+    if((size_t)(end-*p) < n)
+    {
+        return 0;
+    }
+    if(dest)
+    {
+        memcpy(dest, *p, n);
+    }
+    (*p) += n;
+    return 1;
+}
+
+
+/*
+ * Read a string from the cache file and advance *p past it.
+ *
+ * Returns 1 and sets *str to point to the string in the cache file (or NULL if
+ * the saved string was a NULL pointer), or 0 if the string is malformed.
+ */
+static int get_str(char **p, char *end, char **str)
+{
+    uint32_t len;
+    if(!get_bytes(p, end, &len, sizeof(len)))
+    {
+        return 0;
+    }
+
+    if(len == UINT32_MAX)
+    {
+        *str = NULL;
+        return 1;
+    }
+
+    *str = *p;
+    return get_bytes(p, end, NULL, (size_t)len+1) && (*str)[len] == '\0';
+}
+
+
+/*
+ * Read a node from the cache file and advance *p past the node and its children.
+ * If res is NULL, we only check the node is well-formed, otherwise we build a
+ * nodetree out of the node and its children, and store its root in *res.
+ *
+ * Returns 1 if the node is read successfully, 0 otherwise.
+ */
+static int get_node(char **p, char *end, struct node_s **res)
+{
+    struct ast_cache_node_s rec;
+    union  symval_u val = { 0 };
+    if(!get_bytes(p, end, &rec, sizeof(rec)) ||
+       rec.type > NODE_COPROC || rec.val_type > VAL_STR)
+    {
+        return 0;
+    }
+
+    /* the node's value */
+    switch(rec.val_type)
+    {
+        case 0:
+            break;
+
+        case VAL_STR:
+            if(!get_str(p, end, &val.str))
+            {
+                return 0;
+            }
+            break;
+
+        case VAL_CHR:
+            if(!get_bytes(p, end, &val.chr, sizeof(val.chr)))
+            {
+                return 0;
+            }
+            break;
+
+        default:
+            if(!get_bytes(p, end, &val, sizeof(val)))
+            {
+                return 0;
+            }
+            break;
+    }
+
+    struct node_s *node = NULL;
+    if(res)
+    {
+        if(!(node = new_node(rec.type)))
+        {
+            PRINT_ERROR("%s: insufficient memory for parser node struct\n", SOURCE_NAME);
+            return 0;
+        }
+        node->val_type = rec.val_type;
+        node->val      = val;
+        node->children = rec.children;
+        node->lineno   = rec.lineno;
+        if(rec.val_type == VAL_STR && val.str)
+        {
+            node->val.str = get_malloced_str(val.str);
+        }
+    }
+
+    /* the node's children */
+    struct node_s *child, *prev = NULL;
+    uint32_t i;
+    for(i = 0; i < rec.nchild; i++)
+    {
+        if(!get_node(p, end, res ? &child : NULL))
+        {
+            free_node_tree(node);
+            return 0;
+        }
+
+        if(!res)
+        {
+            continue;
+        }
+
+        if(prev)
+        {
+            prev->next_sibling = child;
+        }
+        else
+        {
+            node->first_child = child;
+        }
+        prev = child;
+    }
+
+    if(res)
+    {
+        *res = node;
+    }
+    return 1;
+}
+
+
+/*
+ * Check the n alias lookups saved at *p, and advance *p past them. Every word
+ * the parser checked for aliases must still have the same alias value (or still
+ * not be an alias), otherwise the file might parse differently.
+ *
+ * Returns 1 if the alias lookups still hold, 0 otherwise.
+ */
+static int check_alias_lookups(char **p, char *end, uint32_t n)
+{
+    uint32_t i;
+    for(i = 0; i < n; i++)
+    {
+        char *name, *val;
+        if(!get_str(p, end, &name) || !get_str(p, end, &val) || !name || !val)
+        {
+            return 0;
+        }
+
+        char *cur = get_alias_val(name);
+        if(cur == name || !cur)
+        {
+            if(*val)
+            {
+                return 0;
+            }
+        }
+        else if(*val != '=' || strcmp(cur, val+1) != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*
+ * Check that the mapped cache file belongs to the given script file, and that
+ * it was written by this version of the shell, in the same parser state and with
+ * the same aliases we have now. We also make sure the saved commands are well-
+ * formed before we execute any of them.
+ *
+ * Returns 1 if the cache file is valid, 0 otherwise.
+ */
+static int check_ast_cache(struct ast_cache_s *cache, char *path, struct stat *st)
+{
+    struct ast_cache_header_s hdr;
+    char *p = cache->map, *end = cache->end;
+    if(!get_bytes(&p, end, &hdr, sizeof(hdr)))
+    {
+        return 0;
+    }
+
+    if(memcmp(hdr.magic, AST_CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+       hdr.format    != AST_CACHE_FORMAT                          ||
+       hdr.state     != parser_state()                            ||
+       hdr.dev       != (uint64_t)st->st_dev                      ||
+       hdr.ino       != (uint64_t)st->st_ino                      ||
+       hdr.size      != (uint64_t)st->st_size                     ||
+       hdr.mtime_sec != (int64_t)st->st_mtim.tv_sec               ||
+       hdr.mtime_nsec!= (int64_t)st->st_mtim.tv_nsec)
+    {
+        return 0;
+    }
+
+    /* the shell version and the script file's path */
+    char *s = p;
+    if(hdr.verlen != strlen(shell_ver) || !get_bytes(&p, end, NULL, hdr.verlen) ||
+       memcmp(s, shell_ver, hdr.verlen) != 0)
+    {
+        return 0;
+    }
+
+    s = p;
+    if(hdr.pathlen != strlen(path) || !get_bytes(&p, end, NULL, hdr.pathlen) ||
+       memcmp(s, path, hdr.pathlen) != 0)
+    {
+        return 0;
+    }
+
+    if(!check_alias_lookups(&p, end, hdr.naliases))
+    {
+        return 0;
+    }
+
+    /* make sure the commands are well-formed */
+    uint32_t i;
+    cache->next = p;
+    for(i = 0; i < hdr.ncmds; i++)
+    {
+        if(!get_bytes(&p, end, NULL, sizeof(int32_t)) || !get_node(&p, end, NULL))
+        {
+            return 0;
+        }
+    }
+    return p == end;
+}
+
+
+/*
+ * Load the cached nodetrees of the file we read into the given input source,
+ * if the AST cache is enabled and we have a valid cache file for the file.
+ *
+ * Returns 1 if the cache file is loaded, 0 otherwise. If the file is loaded,
+ * call next_cached_cmd() to get the commands, then close_ast_cache() when done.
+ */
+int load_ast_cache(struct source_s *src, struct ast_cache_s *cache)
+{
+    cache->map   = NULL;
+    cache->entry = NULL;
+    if(!optionx_set(OPTION_AST_CACHE) || !ast_cache_usable(src))
+    {
+        return 0;
+    }
+
+    char *path = realpath(src->srcname, NULL);
+    if(!path)
+    {
+        return 0;
+    }
+
+    char *file = cache_file_path(path, 0);
+    int fd = file ? open(file, O_RDONLY | O_CLOEXEC) : -1;
+    if(file)
+    {
+        free(file);
+    }
+    if(fd < 0)
+    {
+        free(path);
+        return 0;
+    }
+
+    /* only trust cache files written by us */
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+       st.st_size < (off_t)sizeof(struct ast_cache_header_s))
+    {
+        close(fd);
+        free(path);
+        return 0;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        free(path);
+        return 0;
+    }
+
+    cache->map     = map;
+    cache->mapsize = st.st_size;
+    cache->end     = map+st.st_size;
+    int res = check_ast_cache(cache, path, &src->filestat);
+    free(path);
+    if(!res)
+    {
+        close_ast_cache(cache);
+    }
+    return res;
+}
+
+
+/*
+ * Get the maximum size of the source cache in bytes, which is given in kilobytes
+ * by the $SOURCECACHESIZE variable. Zero disables the source cache.
+ */
+static size_t source_cache_limit(void)
+{
+    long size = get_shell_varl("SOURCECACHESIZE", SOURCE_CACHE_DEFAULT_SIZE);
+    return (size > 0) ? (size_t)size * 1024 : 0;
+}
+
+
+/*
+ * Free the given source cache entry and its nodetrees.
+ */
+static void free_source_cache_entry(struct source_cache_entry_s *entry)
+{
+    uint32_t i;
+    for(i = 0; i < entry->ncmds; i++)
+    {
+        free_node_tree(entry->cmds[i].tree);
+    }
+    free(entry->cmds);
+    free(entry->aliases);
+    free(entry);
+}
+
+
+/*
+ * Release an entry we got from load_source_cache(). If the entry was removed
+ * from the cache while we were executing its commands, it is freed now.
+ */
+static void release_source_cache_entry(struct source_cache_entry_s *entry)
+{
+    if(--entry->refs == 0 && entry->unlinked)
+    {
+        free_source_cache_entry(entry);
+    }
+}
+
+
+/*
+ * Remove the entry pointed to by *link from the source cache. The entry is
+ * freed, unless some dot file is executing its commands.
+ */
+static void unlink_source_cache_entry(struct source_cache_entry_s **link)
+{
+    struct source_cache_entry_s *entry = *link;
+    *link = entry->next;
+    source_cache.size -= entry->memsize;
+    source_cache.count--;
+    entry->unlinked = 1;
+    if(entry->refs == 0)
+    {
+        free_source_cache_entry(entry);
+    }
+}
+
+
+/*
+ * Remove the least recently used entries from the source cache until it fits
+ * in the given size.
+ */
+static void trim_source_cache(size_t limit)
+{
+    struct source_cache_entry_s **link = &source_cache.first;
+    size_t size = 0;
+    while(*link)
+    {
+        if(size+(*link)->memsize > limit)
+        {
+            unlink_source_cache_entry(link);
+            continue;
+        }
+        size += (*link)->memsize;
+        link = &(*link)->next;
+    }
+}
+
+
+/*
+ * Find the source cache entry of the dot file with the given status. An entry of
+ * the same file with a different size or modification time is stale, and is
+ * removed from the cache.
+ *
+ * Returns a pointer to the link that points to the entry, or NULL if the file
+ * has no entry.
+ */
+static struct source_cache_entry_s **find_source_cache_entry(struct stat *st)
+{
+    struct source_cache_entry_s **link = &source_cache.first;
+    for( ; *link; link = &(*link)->next)
+    {
+        struct source_cache_entry_s *entry = *link;
+        if(entry->dev != st->st_dev || entry->ino != st->st_ino)
+        {
+            continue;
+        }
+
+        if(entry->size != st->st_size || entry->mtime.tv_sec != st->st_mtim.tv_sec ||
+           entry->mtime.tv_nsec != st->st_mtim.tv_nsec)
+        {
+            unlink_source_cache_entry(link);
+            return NULL;
+        }
+        return link;
+    }
+    return NULL;
+}
+
+
+/*
+ * Look up the dot file in path in the source cache. The file's name is expanded
+ * the same way read_file() does.
+ *
+ * Returns 1 if the file's parsed commands are in the cache, in which case src is
+ * set up as if we've read the file (except we don't have the file's text), and
+ * the commands can be read by calling next_cached_cmd(). Call close_ast_cache()
+ * when done. Returns 0 if the file is not in the cache.
+ */
+int load_source_cache(char *path, struct source_s *src, struct ast_cache_s *cache)
+{
+    cache->map   = NULL;
+    cache->entry = NULL;
+
+    /* $SOURCECACHESIZE might have been decreased since we added the last entry */
+    size_t limit = source_cache_limit();
+    trim_source_cache(limit);
+    if(!limit || option_set('r') || option_set('v') || optionx_set(OPTION_SAVE_HIST))
+    {
+        return 0;
+    }
+
+    char *filename = word_expand_to_str(path);
+    if(!filename)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    struct source_cache_entry_s **link;
+    if(stat(filename, &st) != 0 || !S_ISREG(st.st_mode) || access(filename, R_OK) != 0 ||
+       !(link = find_source_cache_entry(&st)))
+    {
+        source_cache.misses++;
+        free(filename);
+        return 0;
+    }
+
+    /* the file must be parsed the same way it was parsed when we cached it */
+    struct source_cache_entry_s *entry = *link;
+    char *p = entry->aliases;
+    if(entry->state != parser_state() ||
+       !check_alias_lookups(&p, p+entry->aliaslen, entry->naliases))
+    {
+        source_cache.misses++;
+        free(filename);
+        return 0;
+    }
+
+    /* move the entry to the head of the list */
+    *link = entry->next;
+    entry->next = source_cache.first;
+    source_cache.first = entry;
+    source_cache.hits++;
+
+    entry->refs++;
+    cache->entry = entry;
+    cache->index = 0;
+
+    src->buffer   = NULL;
+    src->bufsize  = 0;
+    src->buftype  = SOURCE_BUF_OWNED;
+    src->srctype  = SOURCE_DOTFILE;
+    src->srcname  = get_malloced_str(filename);
+    src->curpos   = INIT_SRC_POS;
+    src->curline  = 1;
+    src->filestat = st;
+    free(filename);
+    return 1;
+}
+
+
+/*
+ * Get the next command from the given cache file or source cache entry, and set
+ * *curline to the line number the command was executed at. The nodes of commands
+ * we read from cache files are created in the current node arena (if any), just
+ * like the parser does, while source cache entries give us their packed nodetrees.
+ * Either way, pass the command to free_cached_cmd() when done.
+ *
+ * Returns the command's nodetree, or NULL if there are no more commands.
+ */
+struct node_s *next_cached_cmd(struct ast_cache_s *cache, long *curline)
+{
+    int32_t line;
+    struct node_s *cmd = NULL;
+    if(cache->entry)
+    {
+        if(cache->index >= cache->entry->ncmds)
+        {
+            return NULL;
+        }
+        *curline = cache->entry->cmds[cache->index].curline;
+        return cache->entry->cmds[cache->index++].tree;
+    }
+
+    if(!cache->map || !get_bytes(&cache->next, cache->end, &line, sizeof(line)) ||
+       !get_node(&cache->next, cache->end, &cmd))
+    {
+        return NULL;
+    }
+    *curline = line;
+    return cmd;
+}
+
+
+/*
+ * Free a command we got from next_cached_cmd(). The nodetrees of source cache
+ * entries are kept in the cache.
+ */
+void free_cached_cmd(struct ast_cache_s *cache, struct node_s *cmd)
+{
+    if(!cache->entry)
+    {
+        free_node_tree(cmd);
+    }
+}
+
+
+/*
+ * Unmap the given cache file, or release the given source cache entry.
+ */
+void close_ast_cache(struct ast_cache_s *cache)
+{
+    if(cache->map)
+    {
+        munmap(cache->map, cache->mapsize);
+        cache->map = NULL;
+    }
+    if(cache->entry)
+    {
+        release_source_cache_entry(cache->entry);
+        cache->entry = NULL;
+    }
+}
+
+
+/*
+ * Append n bytes to the writer's buffer, growing the buffer as needed.
+ */
+static void put_bytes(struct ast_cache_writer_s *writer, void *src, size_t n)
+{
+    if(writer->failed)
+    {
+        return;
+    }
+
+    if(writer->len+n > writer->size)
+    {
+        size_t size = writer->size ? writer->size : 4096;
+        while(size < writer->len+n)
+        {
+            size <<= 1;
+        }
+
+        char *buf = realloc(writer->buf, size);
+        if(!buf)
+        {
+            writer->failed = 1;
+            return;
+        }
+        writer->buf  = buf;
+        writer->size = size;
+    }
+
+    memcpy(writer->buf+writer->len, src, n);
+    writer->len += n;
+}
+
+
+/*
+ * Append a string to the writer's buffer, in the format get_str() expects.
+ */
+static void put_str(struct ast_cache_writer_s *writer, char *str)
+{
+    uint32_t len = str ? strlen(str) : UINT32_MAX;
+    put_bytes(writer, &len, sizeof(len));
+    if(str)
+    {
+        put_bytes(writer, str, (size_t)len+1);
+    }
+}
+
+
+/*
+ * Append a node and its children to the writer's buffer.
+ */
+static void put_node(struct ast_cache_writer_s *writer, struct node_s *node)
+{
+    struct ast_cache_node_s rec;
+    struct node_s *child;
+    memset(&rec, 0, sizeof(rec));
+    rec.type     = node->type;
+    rec.val_type = node->val_type;
+    rec.children = node->children;
+    rec.lineno   = node->lineno;
+    for(child = node->first_child; child; child = child->next_sibling)
+    {
+        rec.nchild++;
+    }
+    put_bytes(writer, &rec, sizeof(rec));
+
+    /* the node's value (nodes with no value have a zero val_type) */
+    if(node->val_type == VAL_STR)
+    {
+        put_str(writer, node->val.str);
+    }
+    else if(node->val_type == VAL_CHR)
+    {
+        put_bytes(writer, &node->val.chr, sizeof(node->val.chr));
+    }
+    else if(node->val_type)
+    {
+        put_bytes(writer, &node->val, sizeof(node->val));
+    }
+
+    for(child = node->first_child; child; child = child->next_sibling)
+    {
+        put_node(writer, child);
+    }
+}
+
+
+/*
+ * Prepare to cache the commands we'll parse from the given input source. The
+ * commands are saved to a cache file if the 'astcache' option is set, and dot
+ * files are also added to the source cache. The caller adds each command by
+ * calling add_ast_cache_cmd() after parsing it, then calls end_ast_cache() when
+ * done.
+ *
+ * Returns 1 if we are caching the file, 0 if not (in which case the caller
+ * should not call the other functions).
+ */
+int begin_ast_cache(struct source_s *src, struct ast_cache_writer_s *writer)
+{
+    if(!ast_cache_usable(src))
+    {
+        return 0;
+    }
+
+    /*
+     * if the file was modified very recently, it might be modified again without
+     * its mtime changing (on file systems with coarse timestamps), in which case
+     * we won't notice the cached commands are stale. cache it the next time.
+     */
+    if(time(NULL)-src->filestat.st_mtime < 2)
+    {
+        return 0;
+    }
+
+    writer->path      = NULL;
+    writer->to_disk   = optionx_set(OPTION_AST_CACHE);
+    writer->to_memory = (src->srctype == SOURCE_DOTFILE && source_cache_limit());
+    if(writer->to_disk && !(writer->path = realpath(src->srcname, NULL)))
+    {
+        writer->to_disk = 0;
+    }
+
+    if(!writer->to_disk && !writer->to_memory)
+    {
+        return 0;
+    }
+
+    writer->filestat  = src->filestat;
+    writer->state     = parser_state();
+    writer->buf       = NULL;
+    writer->len       = 0;
+    writer->size      = 0;
+    writer->ncmds     = 0;
+    writer->aliases   = NULL;
+    writer->failed    = 0;
+    writer->cmds      = NULL;
+    writer->cmds_size = 0;
+    return 1;
+}
+
+
+/*
+ * Add a command we've just parsed to the given writer. curline is the line
+ * number we should restore before executing the command.
+ */
+void add_ast_cache_cmd(struct ast_cache_writer_s *writer, struct node_s *cmd, long curline)
+{
+    /* an earlier command changed the way we parse the file (e.g. set --posix) */
+    if(parser_state() != writer->state)
+    {
+        writer->failed = 1;
+    }
+
+    if(writer->failed)
+    {
+        return;
+    }
+
+    if(writer->to_disk)
+    {
+        int32_t line = curline;
+        put_bytes(writer, &line, sizeof(line));
+        put_node(writer, cmd);
+    }
+
+    /* keep a packed copy of the nodetree, as the caller frees the command after executing it */
+    if(writer->to_memory)
+    {
+        if(writer->ncmds == writer->cmds_size)
+        {
+            uint32_t size = writer->cmds_size ? writer->cmds_size*2 : 32;
+            struct source_cache_cmd_s *cmds = realloc(writer->cmds, size*sizeof(*cmds));
+            if(!cmds)
+            {
+                writer->failed = 1;
+                return;
+            }
+            writer->cmds      = cmds;
+            writer->cmds_size = size;
+        }
+
+        struct node_s *tree = pack_node_tree(cmd);
+        if(!tree)
+        {
+            writer->failed = 1;
+            return;
+        }
+        writer->cmds[writer->ncmds].tree    = tree;
+        writer->cmds[writer->ncmds].curline = curline;
+    }
+    writer->ncmds++;
+}
+
+
+/*
+ * Record the result of an alias lookup the parser did for the word in name.
+ * val is the alias value returned by get_alias_val().
+ */
+void note_alias_lookup(char *name, char *val)
+{
+    struct ast_cache_writer_s *writer = cur_ast_cache_writer;
+    if(!writer || writer->failed)
+    {
+        return;
+    }
+
+    if(!writer->aliases && !(writer->aliases = new_hashtable()))
+    {
+        writer->failed = 1;
+        return;
+    }
+
+    /* an empty string means the word is not an alias, otherwise we save '=' and the value */
+    int is_alias = (val && val != name);
+    char buf[is_alias ? strlen(val)+2 : 1];
+    buf[0] = '\0';
+    if(is_alias)
+    {
+        sprintf(buf, "=%s", val);
+    }
+
+    /* the same word had a different alias value earlier in the file */
+    struct hashitem_s *entry = get_hash_item(writer->aliases, name);
+    if(entry)
+    {
+        if(strcmp(entry->val, buf) != 0)
+        {
+            writer->failed = 1;
+        }
+        return;
+    }
+
+    if(!add_hash_item(writer->aliases, name, buf))
+    {
+        writer->failed = 1;
+    }
+}
+
+
+/*
+ * Write n bytes to the given file descriptor.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+static int write_all(int fd, char *buf, size_t n)
+{
+    while(n)
+    {
+        ssize_t res = write(fd, buf, n);
+        if(res < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        buf += res;
+        n   -= res;
+    }
+    return 1;
+}
+
+
+/*
+ * Serialize the alias lookups the writer's parser did into the aliases writer,
+ * in the format check_alias_lookups() expects.
+ *
+ * Returns the number of alias lookups, or -1 on error.
+ */
+static long put_alias_lookups(struct ast_cache_writer_s *writer, struct ast_cache_writer_s *aliases)
+{
+    long naliases = 0;
+    memset(aliases, 0, sizeof(*aliases));
+    if(writer->aliases)
+    {
+        finish_hash_rehash(writer->aliases);
+        struct hashitem_s **h1 = writer->aliases->items;
+        struct hashitem_s **h2 = h1+writer->aliases->size;
+        for( ; h1 < h2; h1++)
+        {
+            struct hashitem_s *entry;
+            for(entry = *h1; entry; entry = entry->next)
+            {
+                put_str(aliases, entry->name);
+                put_str(aliases, entry->val);
+                naliases++;
+            }
+        }
+        if(aliases->failed)
+        {
+            free(aliases->buf);
+            return -1;
+        }
+    }
+    return naliases;
+}
+
+
+/*
+ * Write the commands we've collected to the writer's cache file. We write to
+ * a temporary file first, then rename it, so that other shells never see a
+ * partially written cache file.
+ */
+static void write_ast_cache(struct ast_cache_writer_s *writer)
+{
+    struct ast_cache_writer_s aliases;
+    long naliases = put_alias_lookups(writer, &aliases);
+    if(naliases < 0)
+    {
+        return;
+    }
+
+    struct ast_cache_header_s hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, AST_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.format     = AST_CACHE_FORMAT;
+    hdr.state      = writer->state;
+    hdr.dev        = writer->filestat.st_dev;
+    hdr.ino        = writer->filestat.st_ino;
+    hdr.size       = writer->filestat.st_size;
+    hdr.mtime_sec  = writer->filestat.st_mtim.tv_sec;
+    hdr.mtime_nsec = writer->filestat.st_mtim.tv_nsec;
+    hdr.verlen     = strlen(shell_ver);
+    hdr.pathlen    = strlen(writer->path);
+    hdr.naliases   = naliases;
+    hdr.ncmds      = writer->ncmds;
+
+    char *file = cache_file_path(writer->path, 1);
+    if(!file)
+    {
+        free(aliases.buf);
+        return;
+    }
+
+    char tmp[strlen(file)+32];
+    sprintf(tmp, "%s.%d", file, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd >= 0)
+    {
+        int res = write_all(fd, (char *)&hdr, sizeof(hdr))        &&
+                  write_all(fd, shell_ver, hdr.verlen)            &&
+                  write_all(fd, writer->path, hdr.pathlen)        &&
+                  write_all(fd, aliases.buf, aliases.len)         &&
+                  write_all(fd, writer->buf, writer->len);
+
+        if(close(fd) != 0 || !res || rename(tmp, file) != 0)
+        {
+            unlink(tmp);
+        }
+    }
+
+    free(aliases.buf);
+    free(file);
+}
+
+
+/*
+ * Count the memory used by the given (packed) nodetree and its strings.
+ */
+static size_t packed_tree_size(struct node_s *node)
+{
+    size_t size = sizeof(struct node_s);
+    if(node->val_type == VAL_STR && node->val.str)
+    {
+        size += strlen(node->val.str)+1;
+    }
+
+    struct node_s *child;
+    for(child = node->first_child; child; child = child->next_sibling)
+    {
+        size += packed_tree_size(child);
+    }
+    return size;
+}
+
+
+/*
+ * Add the commands we've collected to the source cache, replacing any entry we
+ * have for the same file, then trim the cache to $SOURCECACHESIZE.
+ */
+static void add_source_cache_entry(struct ast_cache_writer_s *writer)
+{
+    size_t limit = source_cache_limit();
+    struct source_cache_entry_s *entry = malloc(sizeof(struct source_cache_entry_s));
+    if(!limit || !entry)
+    {
+        if(entry)
+        {
+            free(entry);
+        }
+        return;
+    }
+
+    struct ast_cache_writer_s aliases;
+    long naliases = put_alias_lookups(writer, &aliases);
+    if(naliases < 0)
+    {
+        free(entry);
+        return;
+    }
+
+    /* put_bytes() grows the buffer in big steps, give back the memory we don't use */
+    if(aliases.buf && aliases.len < aliases.size)
+    {
+        char *buf = realloc(aliases.buf, aliases.len);
+        if(buf)
+        {
+            aliases.buf  = buf;
+            aliases.size = aliases.len;
+        }
+    }
+
+    /* the entry takes the writer's commands */
+    memset(entry, 0, sizeof(struct source_cache_entry_s));
+    entry->dev      = writer->filestat.st_dev;
+    entry->ino      = writer->filestat.st_ino;
+    entry->size     = writer->filestat.st_size;
+    entry->mtime    = writer->filestat.st_mtim;
+    entry->state    = writer->state;
+    entry->aliases  = aliases.buf;
+    entry->aliaslen = aliases.len;
+    entry->naliases = naliases;
+    entry->cmds     = writer->cmds;
+    entry->ncmds    = writer->ncmds;
+    writer->cmds    = NULL;
+
+    entry->memsize  = sizeof(struct source_cache_entry_s) + aliases.size +
+                      writer->cmds_size * sizeof(struct source_cache_cmd_s);
+    uint32_t i;
+    for(i = 0; i < entry->ncmds; i++)
+    {
+        entry->memsize += packed_tree_size(entry->cmds[i].tree);
+    }
+
+    /* don't cache files that are too big for the cache */
+    if(entry->memsize > limit)
+    {
+        free_source_cache_entry(entry);
+        return;
+    }
+
+    struct source_cache_entry_s **link = find_source_cache_entry(&writer->filestat);
+    if(link)
+    {
+        unlink_source_cache_entry(link);
+    }
+
+    entry->next = source_cache.first;
+    source_cache.first = entry;
+    source_cache.size += entry->memsize;
+    source_cache.count++;
+    trim_source_cache(limit);
+}
+
+
+/*
+ * Finish caching the file we've been parsing. If save is non-zero (i.e. we've
+ * parsed the whole file successfully), the commands are written to the cache
+ * file and/or added to the source cache.
+ */
+void end_ast_cache(struct ast_cache_writer_s *writer, int save)
+{
+    if(save && !writer->failed)
+    {
+        if(writer->to_disk)
+        {
+            write_ast_cache(writer);
+        }
+        if(writer->to_memory)
+        {
+            add_source_cache_entry(writer);
+        }
+    }
+
+    /* the commands we didn't add to the source cache */
+    if(writer->cmds)
+    {
+        uint32_t i;
+        for(i = 0; i < writer->ncmds; i++)
+        {
+            free_node_tree(writer->cmds[i].tree);
+        }
+        free(writer->cmds);
+    }
+
+    if(writer->buf)
+    {
+        free(writer->buf);
+    }
+    if(writer->aliases)
+    {
+        free_hashtable(writer->aliases);
+    }
+    if(writer->path)
+    {
+        free(writer->path);
+    }
+}
@@ -0,0 +1,182 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2016, 2017, 2018, 2019, 2020 (c)
+ *
+ *    file: astcache.h
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AST_CACHE_H
+#define AST_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "parser/node.h"
+#include "symtab/string_hash.h"
+
+/*
+ * The AST cache keeps the parsed commands of script and dot files on disk, so
+ * that the next time we run the same (unchanged) file, we can rebuild the
+ * nodetrees directly instead of lexing and parsing the file again. The cache
+ * is only used if the 'astcache' extended option is set.
+ *
+ * Separately, the source cache keeps the nodetrees of the dot files we've parsed
+ * in memory, so that sourcing the same (unchanged) file again in this shell
+ * doesn't need to read or parse the file at all. Its size is bounded by the
+ * $SOURCECACHESIZE variable.
+ */
+
+/* bump this whenever the layout of cache files changes */
+#define AST_CACHE_FORMAT        1
+
+/* the first bytes of every cache file */
+#define AST_CACHE_MAGIC         "LSHAST\n"
+
+/*
+ * the header of a cache file. it is followed by the shell's version string,
+ * the script file's path, the alias lookups the parser did (see
+ * note_alias_lookup() below), then the serialized commands.
+ */
+struct ast_cache_header_s
+{
+    char     magic[8];      /* AST_CACHE_MAGIC */
+    uint32_t format;        /* AST_CACHE_FORMAT */
+    uint32_t state;         /* the parser state the commands were parsed in */
+    uint64_t dev;           /* the device and inode of the script file.. */
+    uint64_t ino;
+    uint64_t size;          /* ..and its size and modification time */
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint32_t verlen;        /* length of the shell version string */
+    uint32_t pathlen;       /* length of the script file's path */
+    uint32_t naliases;      /* number of alias lookups */
+    uint32_t ncmds;         /* number of commands */
+};
+
+/*
+ * each command is saved as its line number (an int32_t), followed by its
+ * nodetree. each node is saved as the following struct, followed by its value
+ * (if any), then its child nodes. a string value is saved as its length (an
+ * uint32_t, which is UINT32_MAX for NULL strings), followed by the string
+ * and its terminating null byte.
+ */
+struct ast_cache_node_s
+{
+    uint8_t  type;          /* the node's type */
+    uint8_t  val_type;      /* the type of the node's value */
+    uint16_t unused;
+    int32_t  children;      /* the node's children field */
+    int32_t  lineno;        /* the node's line number */
+    uint32_t nchild;        /* number of child nodes that follow this node */
+};
+
+/*
+ * a cache file we've mapped into memory, or a source cache entry, from which
+ * we are reading commands (see load_ast_cache() and load_source_cache()).
+ */
+struct ast_cache_s
+{
+    char   *map;            /* the mapped file */
+    size_t  mapsize;        /* the size of the mapping */
+    char   *next;           /* the next command to read */
+    char   *end;            /* the end of the mapped file */
+    struct source_cache_entry_s *entry; /* the source cache entry, if we're not
+                                         * reading from a cache file */
+    uint32_t index;         /* the next command to read from the entry */
+};
+
+/* a command in a source cache entry */
+struct source_cache_cmd_s
+{
+    struct node_s *tree;    /* the command's (packed) nodetree */
+    long    curline;        /* the line number the command was executed at */
+};
+
+/*
+ * the parsed commands of a dot file we keep in memory. an entry is valid as long
+ * as the file's device, inode, size and modification time don't change.
+ */
+struct source_cache_entry_s
+{
+    struct source_cache_entry_s *next;  /* the next (less recently used) entry */
+    dev_t    dev;           /* the device and inode of the dot file.. */
+    ino_t    ino;
+    off_t    size;          /* ..and its size and modification time */
+    struct timespec mtime;
+    uint32_t state;         /* the parser state the commands were parsed in */
+    char    *aliases;       /* the serialized alias lookups the parser did */
+    size_t   aliaslen;      /* length of the serialized alias lookups */
+    uint32_t naliases;      /* number of alias lookups */
+    struct source_cache_cmd_s *cmds;    /* the commands */
+    uint32_t ncmds;         /* number of commands */
+    size_t   memsize;       /* the memory used by the entry */
+    int      refs;          /* the number of dot files executing the entry */
+    int      unlinked;      /* set if the entry was removed from the cache */
+};
+
+/* the in-memory cache of parsed dot files */
+struct source_cache_s
+{
+    struct source_cache_entry_s *first; /* the entries, most recently used first */
+    size_t   size;          /* the memory used by all the entries */
+    long     count;         /* the number of entries */
+    long     hits;          /* the number of cache hits and misses */
+    long     misses;
+};
+
+/* the default value of $SOURCECACHESIZE (in kilobytes) */
+#define SOURCE_CACHE_DEFAULT_SIZE   1024
+
+extern struct source_cache_s source_cache;
+
+/*
+ * the commands of a file we are parsing, which we'll save to the cache if
+ * we parse the whole file successfully (see begin_ast_cache()).
+ */
+struct ast_cache_writer_s
+{
+    char   *path;           /* the script file's absolute path */
+    struct stat filestat;   /* the script file's status */
+    uint32_t state;         /* the parser state when we started parsing */
+    char   *buf;            /* the serialized commands */
+    size_t  len;            /* length of the serialized commands */
+    size_t  size;           /* size of the memory alloc'd for buf */
+    uint32_t ncmds;         /* number of serialized commands */
+    struct hashtab_s *aliases;  /* alias lookups the parser did */
+    int     failed;         /* set if we can't cache the file */
+    int     to_disk;        /* set if we're saving the commands to a cache file */
+    int     to_memory;      /* set if we're adding the commands to the source cache */
+    struct source_cache_cmd_s *cmds;    /* the packed commands for the source cache */
+    uint32_t cmds_size;     /* the number of commands cmds can hold */
+};
+
+/* the writer of the file we are parsing now, NULL if we aren't caching it */
+extern struct ast_cache_writer_s *cur_ast_cache_writer;
+
+int     load_ast_cache(struct source_s *src, struct ast_cache_s *cache);
+struct  node_s *next_cached_cmd(struct ast_cache_s *cache, long *curline);
+void    close_ast_cache(struct ast_cache_s *cache);
+int     begin_ast_cache(struct source_s *src, struct ast_cache_writer_s *writer);
+void    add_ast_cache_cmd(struct ast_cache_writer_s *writer, struct node_s *cmd, long curline);
+void    end_ast_cache(struct ast_cache_writer_s *writer, int save);
+void    note_alias_lookup(char *name, char *val);
+int     load_source_cache(char *path, struct source_s *src, struct ast_cache_s *cache);
+void    free_cached_cmd(struct ast_cache_s *cache, struct node_s *cmd);
+
+/* defined in main.c */
+int     execute_ast_cache(struct source_s *src, struct ast_cache_s *cache);
+
+#endif
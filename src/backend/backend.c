@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <sched.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -60,6 +61,21 @@ int in_test_clause = 0;
 /* Declared in main.c   */
 extern int read_stdin;
 
+extern char **environ;
+
+/*
+ * Bumped whenever the result of resolving a command word might change, which
+ * invalidates the command resolutions cached in the AST (see resolve_cmd()).
+ */
+unsigned long cmd_cache_epoch = 0;
+
+/*
+ * Set by a pipeline's child process right before it executes a simple command,
+ * to tell do_simple_command() to exec an external command in place, instead of
+ * forking another child process (see do_pipeline()).
+ */
+static int exec_in_place = 0;
+
 
 /*
  * Merge the local symbol table of a builtin or function with the global
@@ -126,6 +142,59 @@ pid_t fork_child(void)
 }
 
 
+/*
+ * Start an external command using posix_spawn(), which is much cheaper than
+ * fork() when the shell's memory is large, as we don't have to copy our page
+ * tables only to discard them when the child exec's. We only do this for simple
+ * commands that don't need any work done in the child process before it exec's
+ * (see do_simple_command()), so the environment and signal dispositions the
+ * child would have set up for itself are passed to posix_spawn() instead.
+ *
+ * Returns the child's pid, or -1 if we failed to spawn the command (e.g. if the
+ * file is a shell script), in which case the caller should fall back to fork().
+ */
+static pid_t spawn_cmd(char *path, char **argv)
+{
+    /* the exported variables and functions (see do_export_vars()) */
+    char **envp = get_export_envp(path);
+    if(!envp)
+    {
+        return -1;
+    }
+
+    posix_spawnattr_t attr;
+    if(posix_spawnattr_init(&attr) != 0)
+    {
+        return -1;
+    }
+
+    /* reset the signals the child would reset in reset_nonignored_traps() */
+    sigset_t sigdef, sigmask, sigset;
+    get_nonignored_traps(&sigdef);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+
+    /* block SIGCHLD while spawning (as fork_child() does), but not in the child */
+    SIGNAL_BLOCK(SIGCHLD, sigset);
+    sigprocmask(SIG_BLOCK, NULL, &sigmask);
+    sigdelset(&sigmask, SIGCHLD);
+    posix_spawnattr_setsigmask(&attr, &sigmask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    int res = posix_spawn(&pid, path, NULL, &attr, argv, envp);
+
+    SIGNAL_UNBLOCK(sigset);
+    posix_spawnattr_destroy(&attr);
+
+    if(res != 0)
+    {
+        errno = res;
+        return -1;
+    }
+    return pid;
+}
+
+
 /*
  * Wait on the child process with the given pid until it changes status.
  * If the struct job_s *job is passed, wait for all processes in the job to finish,
@@ -816,6 +885,8 @@ int do_pipeline(struct source_s *src, struct node_s *node, struct node_s *redire
             close(filedes[1]);
 
             /* Standard input now comes from pipe */
+            /* As we exit right after the command, external commands can be exec'd in place */
+            exec_in_place = (cmd->type == NODE_COMMAND);
             do_command(src, cmd, redirect_list, NULL /* job */);
             exit(exit_status);
         }
@@ -885,6 +956,8 @@ int do_pipeline(struct source_s *src, struct node_s *node, struct node_s *redire
                 close(filedes2[1]);
             }
 
+            /* As we exit right after the command, external commands can be exec'd in place */
+            exec_in_place = (cmd->type == NODE_COMMAND);
             do_command(src, cmd, redirect_list, NULL /* job */);
             exit(exit_status);
         }
@@ -1103,7 +1176,7 @@ int do_brace_group(struct source_s *src, struct node_s *node, struct node_s *red
     if(local_redirects->type == NODE_IO_REDIRECT_LIST && local_redirects != node->first_child)
     {
         redirect_list = local_redirects;
-        last_child = local_redirects->prev_sibling;
+        last_child = prev_child(node, local_redirects);
         last_child->next_sibling = NULL;
     }
     
@@ -1212,6 +1285,8 @@ int do_function_definition(struct node_s *node)
     {
         free_node_tree(func->func_body);
         func->func_body = NULL;
+        /* let cached data that refers to the old body know it's gone */
+        cmd_cache_epoch++;
     }
     
     /* Get the function body */
@@ -1220,14 +1295,18 @@ int do_function_definition(struct node_s *node)
     {
         goto err;
     }
-    func->func_body = func_body;
-    func->val_type = SYM_FUNC;
     
     /* 
-     * Detach the function body from the AST so it won't be freed when we return
-     * to parse_and_execute().
+     * Keep a packed copy of the function body, as the AST will be freed when we
+     * return to parse_and_execute() (the AST might also live in a node arena,
+     * which is reset after the command is executed).
      */
-    node->first_child = NULL;
+    func->func_body = pack_node_tree(func_body);
+    if(!func->func_body)
+    {
+        goto err;
+    }
+    func->val_type = SYM_FUNC;
     
     /* Get the function string, if any */
     struct node_s *func_str = func_body->next_sibling;
@@ -1306,6 +1385,7 @@ int do_function_body(struct source_s *src, int argc, char **argv)
                 //src->srcname  = argv[0];
                 src2.buffer   = f;
                 src2.bufsize  = strlen(f);
+                src2.buftype  = SOURCE_BUF_BORROWED;
                 src2.curpos   = INIT_SRC_POS;
                 
                 /* Save the current and previous token pointers */
@@ -1316,7 +1396,8 @@ int do_function_body(struct source_s *src, int argc, char **argv)
                 struct node_s *body = parse_function_body(tok);
                 if(body)
                 {
-                    func->func_body = body;
+                    func->func_body = pack_node_tree(body);
+                    free_node_tree(body);
                 }
                 func->val_type = SYM_FUNC;
     
@@ -1501,6 +1582,47 @@ static inline void free_argv(int argc, char **argv)
 }
 
 
+/*
+ * Find out if the given command word refers to an enabled builtin utility and/or
+ * a shell function. The result is cached in the command's node, so that the next
+ * time we execute the same node with the same command word, we don't have to
+ * search the builtins list and the functions table again.
+ */
+static void resolve_cmd(struct node_s *node, char *cmd, struct builtin_s **builtin, int *function)
+{
+    struct cmd_cache_s *cache = node->cmd_cache;
+    if(cache && cache->epoch == cmd_cache_epoch && cache->name && strcmp(cache->name, cmd) == 0)
+    {
+        *builtin  = cache->builtin;
+        *function = cache->function;
+        return;
+    }
+
+    *builtin  = is_enabled_builtin(cmd);
+    *function = is_function(cmd);
+
+    /* cache the result */
+    if(!cache)
+    {
+        cache = malloc(sizeof(struct cmd_cache_s));
+        if(!cache)
+        {
+            return;
+        }
+        cache->name = NULL;
+        node->cmd_cache = cache;
+    }
+    if(cache->name)
+    {
+        free_malloced_str(cache->name);
+    }
+    cache->name     = get_malloced_str(cmd);
+    cache->epoch    = cmd_cache_epoch;
+    cache->builtin  = *builtin;
+    cache->function = *function;
+}
+
+
 /*
  * Execute a simple command. This function processes the nodetree of the parsed command,
  * performing I/O redirections and variable assignments as indicated in the command's nodetree.
@@ -1557,6 +1679,13 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
     char *s;
     int saved_noglob = option_set('f');
     
+    /*
+     * If we are a pipeline's child process, we don't need to fork to execute an
+     * external command, as we'll exit right after the command finishes anyway.
+     */
+    int in_place = exec_in_place;
+    exec_in_place = 0;
+    
     /*
      * Push a local symbol table so that any variable assignments won't affect the shell
      * proper. If the simple command we're executing is a builtin or a function, we'll
@@ -1866,14 +1995,15 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
     //int  builtin =  is_builtin(argv[0]);
     struct symtab_entry_s *entry;
     /*
-     * This call returns the struct builtin_s of the command if it refers to a
-     * builtin utility, NULL otherwise.
-     */
-    struct builtin_s *builtin = is_enabled_builtin(argv[0]);
-    /*
-     * This call returns 1 if argv[0] is a defined shell function, 0 otherwise.
+     * Get the struct builtin_s of the command if it refers to a builtin utility
+     * (NULL otherwise), and whether argv[0] is a defined shell function.
      */
-    int function = is_function(argv[0]);
+    struct builtin_s *builtin = NULL;
+    int function = 0;
+    if(argc)
+    {
+        resolve_cmd(node, argv[0], &builtin, &function);
+    }
 
     /*
      * POSIX says non-interactive shell shall exit on redirection errors with
@@ -2011,10 +2141,75 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
         return !assign_error;
     }
     
+    /*
+     * If we're going to fork an external command, search $PATH for the command
+     * here, before we fork, and hash the command's path right away. The child
+     * process will find the path in its copy of the hashtable, instead of
+     * searching $PATH all over again (the same goes for the next time we run
+     * the command). If the search fails, we tell the child not to bother.
+     */
+    int not_found = 0;
+    if(dofork && option_set('h') && !strchr(argv[0], '/') &&
+       strcmp(argv[0], "-") && !get_hashed_path(argv[0]))
+    {
+        char *path = search_path(argv[0], NULL, 1);
+        if(path)
+        {
+            hash_utility(argv[0], path);
+            free_malloced_str(path);
+        }
+        else
+        {
+            not_found = 1;
+        }
+    }
+    
     pid_t child_pid = 0;
     int is_fg = (job && flag_set(job->flags, JOB_FLAG_FORGROUND));
 
-    if(dofork && (child_pid = fork_child()) == 0)
+    /*
+     * If the child process has nothing to do before exec'ing the command (no I/O
+     * redirections, no job control to set up, and we know the command's path),
+     * use posix_spawn() instead of fork(). If that fails, we fall back to fork().
+     */
+    if(dofork && !in_place && total_redirects == 0 && !job && !not_found && strcmp(argv[0], "-"))
+    {
+        char *path = NULL;
+        if(strchr(argv[0], '/'))
+        {
+            /* r-shells can't specify commands with '/' in their names */
+            if(!(startup_finished && option_set('r')) && file_exists(argv[0]))
+            {
+                path = argv[0];
+            }
+        }
+        else if(option_set('h'))
+        {
+            path = get_hashed_path(argv[0]);
+            /* Check the hashed path still exists (bash) */
+            if(path && optionx_set(OPTION_CHECK_HASH) && !file_exists(path))
+            {
+                path = NULL;
+            }
+        }
+
+        if(path && (child_pid = spawn_cmd(path, argv)) < 0)
+        {
+            child_pid = 0;
+        }
+    }
+
+    /*
+     * Get the command's environment before we fork, so that it gets cached in
+     * the parent process, not in the child (see get_export_envp()).
+     */
+    char **envp = NULL;
+    if(dofork && child_pid == 0)
+    {
+        envp = get_export_envp(NULL);
+    }
+
+    if(dofork && child_pid == 0 && (in_place || (child_pid = fork_child()) == 0))
     {
         /* Set our pgid */
         if(job)
@@ -2036,7 +2231,14 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
         reset_nonignored_traps();
 
         /* Export the variables marked for export */
-        do_export_vars(EXPORT_VARS_EXPORTED_ONLY);
+        if(envp)
+        {
+            environ = envp;
+        }
+        else
+        {
+            do_export_vars(EXPORT_VARS_EXPORTED_ONLY);
+        }
     }
     
 
@@ -2115,7 +2317,15 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
         }
         
         /* POSIX Command Search and Execution Algorithm:      */
-        search_and_exec(src, argc, argv, NULL, SEARCH_AND_EXEC_DOFUNC);
+        if(not_found)
+        {
+            /* we've already searched $PATH (see above) */
+            errno = ENOENT;
+        }
+        else
+        {
+            search_and_exec(src, argc, argv, NULL, SEARCH_AND_EXEC_DOFUNC);
+        }
 
         /* Restore standard streams */
         if(do_savestd && total_redirects)
@@ -2199,28 +2409,6 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
         tcsetpgrp(cur_tty_fd(), shell_pid);
     }
 
-    /*
-     * If we forked, we didn't hash the utility's path in our
-     * hashtable. if so, do it now.
-     */
-    //int cmdfound = WIFEXITED(status) && WEXITSTATUS(status) != 126 && WEXITSTATUS(status) != 127;
-    if(option_set('h') /* && cmdfound */ && dofork)
-    {
-        if(!strchr(argv[0], '/'))
-        {
-            char *path = get_hashed_path(argv[0]);
-            if(!path)
-            {
-                path = search_path(argv[0], NULL, 1);
-                if(path)
-                {
-                    hash_utility(argv[0], path);
-                    free_malloced_str(path);
-                }
-            }
-        }
-    }
-
     free_symtab(symtab_stack_pop());
 
     /* In tcsh, special alias postcmd is run after running each command */
@@ -112,6 +112,7 @@ void redirect_proc_do(char *cmdline, char op, int fd)
         src.bufsize  = strlen(cmdline);
         src.curpos   = INIT_SRC_POS;
         src.srctype  = SOURCE_FIFO;
+        src.buftype  = SOURCE_BUF_BORROWED;
         src.srcname  = NULL;
 
         parse_and_execute(&src);
@@ -32,6 +32,10 @@
  * 
  * NOTE: The %% sequence in a utility's synopsis will be converted to the 
  *       utility's name when the synopsis is printed.
+ * 
+ * NOTE: The list MUST be kept sorted by utility name (in the C locale), as
+ *       is_builtin() uses binary search to find a utility. Also remember to
+ *       update the *_BUILTIN macros in builtins.h when adding a new utility.
  */
 
 struct builtin_s shell_builtins[] =
@@ -531,6 +535,27 @@ struct builtin_s shell_builtins[] =
         "  -q        do not output messages in case of error or no mail\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
+    {
+        "mapfile", "read lines from standard input into variables",
+        mapfile_builtin,       /* non-POSIX */
+        "%% [-hv] [-t] [-d delim] [-n count] [-O origin] [-s count] [-u fd] [name]",
+        "delim       end each line at the first character of delim instead of a newline\n"
+        "count       the number of lines to store (-n), or to discard first (-s)\n"
+        "origin      the index of the first line (default is 0)\n"
+        "fd          file descriptor to use instead of stdin (0)\n"
+        "name        the prefix of the shell variables to assign lines to. Line N is\n"
+        "              assigned to variable nameN, and the index that follows the last\n"
+        "              line is assigned to name_count. If name is not supplied,\n"
+        "              MAPFILE is used\n\n"
+        "Options:\n"
+        "  -d        end lines at delim (instead of newline)\n"
+        "  -n        store at most count lines (0 means all lines)\n"
+        "  -O        assign lines starting at index origin\n"
+        "  -s        discard the first count lines\n"
+        "  -t        remove the delimiter from the end of each line\n"
+        "  -u        read from fd (instead of stdin)\n",
+        BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
+    },
     {
         "memusage", "show the shell's memory usage",
         memusage_builtin,       /* non-POSIX */
@@ -542,6 +567,9 @@ struct builtin_s shell_builtins[] =
         "  hash, hashtab       show the memory allocated for the commands hashtable\n"
         "  history             show the memory allocated for the command line history table\n"
         "  input               show the memory allocated for the currently executing translation unit\n"
+        "  nodes, ast          show the memory allocated for the parse trees of executing commands\n"
+        "  srccache, sourcecache\n"
+        "                      show the memory allocated for the parse trees of cached dot files\n"
         "  stack, symtabs      show the memory allocated for the symbol table stack\n"
         "  strbuf, strtab      show the memory allocated for the internal strings buffer\n"
         "  traps               show the memory allocated for the signal traps\n"
@@ -668,6 +696,27 @@ struct builtin_s shell_builtins[] =
         "  -r        read from fd (instead of stdin)\n\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
+    {
+        "readarray", "read lines from standard input into variables",
+        mapfile_builtin,       /* non-POSIX */
+        "%% [-hv] [-t] [-d delim] [-n count] [-O origin] [-s count] [-u fd] [name]",
+        "delim       end each line at the first character of delim instead of a newline\n"
+        "count       the number of lines to store (-n), or to discard first (-s)\n"
+        "origin      the index of the first line (default is 0)\n"
+        "fd          file descriptor to use instead of stdin (0)\n"
+        "name        the prefix of the shell variables to assign lines to. Line N is\n"
+        "              assigned to variable nameN, and the index that follows the last\n"
+        "              line is assigned to name_count. If name is not supplied,\n"
+        "              MAPFILE is used\n\n"
+        "Options:\n"
+        "  -d        end lines at delim (instead of newline)\n"
+        "  -n        store at most count lines (0 means all lines)\n"
+        "  -O        assign lines starting at index origin\n"
+        "  -s        discard the first count lines\n"
+        "  -t        remove the delimiter from the end of each line\n"
+        "  -u        read from fd (instead of stdin)\n",
+        BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
+    },
     {
         "readonly", "set the readonly attribute for variables",
         readonly_builtin,       /* POSIX */
@@ -779,6 +828,7 @@ struct builtin_s shell_builtins[] =
         "            which the option was taken/based; 'int' means interactive shell, 'non-int'\n"
         "            means non-interactive shell):\n"
         "addsuffix          append space to file- and slash to dir-names on tab completion (tcsh)\n"
+        "astcache           cache parsed script and dot files in $XDG_CACHE_HOME/lsh\n"
         "autocd             dirs passed as single-word commands are passed to 'cd' (bash int)\n"
         "cdable_vars        cd arguments can be variable names (bash)\n"
         "cdable-vars        same as the above\n"
@@ -1090,6 +1140,9 @@ struct builtin_s shell_builtins[] =
 };
 
 
+/* number of builtin utilities (not counting the NULL entry at the end) */
+#define BUILTIN_COUNT       ((int)(sizeof(shell_builtins)/sizeof(struct builtin_s))-1)
+
 #define UTILITY             "builtin"
 
 
@@ -1113,12 +1166,23 @@ struct builtin_s *is_builtin(char *cmd)
         return NULL;
     }
 
-    struct builtin_s *u = shell_builtins;
-    for( ; u->name; u++)
+    /* binary search the (sorted) list of builtin utilities */
+    int lo = 0, hi = BUILTIN_COUNT-1;
+    while(lo <= hi)
     {
-        if(strcmp(u->name, cmd) == 0)
+        int mid = (lo+hi)/2;
+        int res = strcmp(shell_builtins[mid].name, cmd);
+        if(res == 0)
+        {
+            return &shell_builtins[mid];
+        }
+        else if(res < 0)
+        {
+            lo = mid+1;
+        }
+        else
         {
-            return u;
+            hi = mid-1;
         }
     }
     return NULL;
@@ -1259,6 +1323,7 @@ void disable_nonposix_builtins(void)
     LOCAL_BUILTIN.flags     &= ~BUILTIN_ENABLED;
     LOGOUT_BUILTIN.flags    &= ~BUILTIN_ENABLED;
     MAILCHECK_BUILTIN.flags &= ~BUILTIN_ENABLED;
+    MAPFILE_BUILTIN.flags   &= ~BUILTIN_ENABLED;
     MEMUSAGE_BUILTIN.flags  &= ~BUILTIN_ENABLED;
     NICE_BUILTIN.flags      &= ~BUILTIN_ENABLED;
     NOHUP_BUILTIN.flags     &= ~BUILTIN_ENABLED;
@@ -1266,6 +1331,7 @@ void disable_nonposix_builtins(void)
     POPD_BUILTIN.flags      &= ~BUILTIN_ENABLED;
     PRINTENV_BUILTIN.flags  &= ~BUILTIN_ENABLED;
     PUSHD_BUILTIN.flags     &= ~BUILTIN_ENABLED;
+    READARRAY_BUILTIN.flags &= ~BUILTIN_ENABLED;
     REPEAT_BUILTIN.flags    &= ~BUILTIN_ENABLED;
     SETENV_BUILTIN.flags    &= ~BUILTIN_ENABLED;
     SETX_BUILTIN.flags      &= ~BUILTIN_ENABLED;
@@ -1277,6 +1343,7 @@ void disable_nonposix_builtins(void)
     UNSETENV_BUILTIN.flags  &= ~BUILTIN_ENABLED;
     VER_BUILTIN.flags       &= ~BUILTIN_ENABLED;
     WHENCE_BUILTIN.flags    &= ~BUILTIN_ENABLED;
+    cmd_cache_epoch++;
 
     /*
      * We won't disable the 'enable' builtin so the user can selectively enable builtins
@@ -117,6 +117,7 @@ void    do_echo(int v, int argc, char **argv, int flags);
 int     is_list_terminator(char *c);
 void    do_export_vars(int force_export_all);
 void    do_export_table(struct symtab_s *symtab, int force_export_all);
+char  **get_export_envp(char *underscore);
 void    print_var_attribs(unsigned int attr, char *var_perfix, char *func_prefix);
 int     process_var_attribs(char **args, int unexport, int funcs, int flag);
 
@@ -193,6 +194,7 @@ int     let_builtin(int argc, char **argv);
 int     local_builtin(int argc, char **argv);
 int     logout_builtin(int argc, char **argv);
 int     mailcheck_builtin(int argc, char **argv);
+int     mapfile_builtin(int argc, char **argv);
 int     memusage_builtin(int argc, char **argv);
 int     newgrp_builtin(int argc, char **argv);
 int     nice_builtin(int argc, char **argv);
@@ -287,42 +289,44 @@ int     times_builtin(int argc, char *argv[]);
 #define LOCAL_BUILTIN               shell_builtins[35]
 #define LOGOUT_BUILTIN              shell_builtins[36]
 #define MAILCHECK_BUILTIN           shell_builtins[37]
-#define MEMUSAGE_BUILTIN            shell_builtins[38]
-#define NEWGRP_BUILTIN              shell_builtins[39]
-#define NICE_BUILTIN                shell_builtins[40]
-#define NOHUP_BUILTIN               shell_builtins[41]
-#define NOTIFY_BUILTIN              shell_builtins[42]
-#define POPD_BUILTIN                shell_builtins[43]
-#define PRINTENV_BUILTIN            shell_builtins[44]
-#define PUSHD_BUILTIN               shell_builtins[45]
-#define PWD_BUILTIN                 shell_builtins[46]
-#define READ_BUILTIN                shell_builtins[47]
-#define READONLY_BUILTIN            shell_builtins[48]
-#define REPEAT_BUILTIN              shell_builtins[49]
-#define RETURN_BUILTIN              shell_builtins[50]
-#define SET_BUILTIN                 shell_builtins[51]
-#define SETENV_BUILTIN              shell_builtins[52]
-#define SETX_BUILTIN                shell_builtins[53]
-#define SHIFT_BUILTIN               shell_builtins[54]
-#define SHOPT_BUILTIN               shell_builtins[55]
-#define SOURCE_BUILTIN              shell_builtins[56]
-#define STOP_BUILTIN                shell_builtins[57]
-#define SUSPEND_BUILTIN             shell_builtins[58]
-#define TEST3_BUILTIN               shell_builtins[59]
-#define TIMES_BUILTIN               shell_builtins[60]
-#define TRAP_BUILTIN                shell_builtins[61]
-#define TRUE_BUILTIN                shell_builtins[62]
-#define TYPE_BUILTIN                shell_builtins[63]
-#define TYPESET_BUILTIN             shell_builtins[64]
-#define ULIMIT_BUILTIN              shell_builtins[65]
-#define UMASK_BUILTIN               shell_builtins[66]
-#define UNALIAS_BUILTIN             shell_builtins[67]
-#define UNLIMIT_BUILTIN             shell_builtins[68]
-#define UNSET_BUILTIN               shell_builtins[69]
-#define UNSETENV_BUILTIN            shell_builtins[70]
-#define VER_BUILTIN                 shell_builtins[71]
-#define WAIT_BUILTIN                shell_builtins[72]
-#define WHENCE_BUILTIN              shell_builtins[73]
+#define MAPFILE_BUILTIN             shell_builtins[38]
+#define MEMUSAGE_BUILTIN            shell_builtins[39]
+#define NEWGRP_BUILTIN              shell_builtins[40]
+#define NICE_BUILTIN                shell_builtins[41]
+#define NOHUP_BUILTIN               shell_builtins[42]
+#define NOTIFY_BUILTIN              shell_builtins[43]
+#define POPD_BUILTIN                shell_builtins[44]
+#define PRINTENV_BUILTIN            shell_builtins[45]
+#define PUSHD_BUILTIN               shell_builtins[46]
+#define PWD_BUILTIN                 shell_builtins[47]
+#define READ_BUILTIN                shell_builtins[48]
+#define READARRAY_BUILTIN           shell_builtins[49]
+#define READONLY_BUILTIN            shell_builtins[50]
+#define REPEAT_BUILTIN              shell_builtins[51]
+#define RETURN_BUILTIN              shell_builtins[52]
+#define SET_BUILTIN                 shell_builtins[53]
+#define SETENV_BUILTIN              shell_builtins[54]
+#define SETX_BUILTIN                shell_builtins[55]
+#define SHIFT_BUILTIN               shell_builtins[56]
+#define SHOPT_BUILTIN               shell_builtins[57]
+#define SOURCE_BUILTIN              shell_builtins[58]
+#define STOP_BUILTIN                shell_builtins[59]
+#define SUSPEND_BUILTIN             shell_builtins[60]
+#define TEST3_BUILTIN               shell_builtins[61]
+#define TIMES_BUILTIN               shell_builtins[62]
+#define TRAP_BUILTIN                shell_builtins[63]
+#define TRUE_BUILTIN                shell_builtins[64]
+#define TYPE_BUILTIN                shell_builtins[65]
+#define TYPESET_BUILTIN             shell_builtins[66]
+#define ULIMIT_BUILTIN              shell_builtins[67]
+#define UMASK_BUILTIN               shell_builtins[68]
+#define UNALIAS_BUILTIN             shell_builtins[69]
+#define UNLIMIT_BUILTIN             shell_builtins[70]
+#define UNSET_BUILTIN               shell_builtins[71]
+#define UNSETENV_BUILTIN            shell_builtins[72]
+#define VER_BUILTIN                 shell_builtins[73]
+#define WAIT_BUILTIN                shell_builtins[74]
+#define WHENCE_BUILTIN              shell_builtins[75]
 
 
 #endif
@@ -447,6 +447,7 @@ void purge_table(struct symtab_s *symtab, struct alpha_list_s *list, int flags)
     
 #ifdef USE_HASH_TABLES
     
+    finish_symtab_rehash(symtab);
     if(symtab->used)
     {
         struct symtab_entry_s **h1 = symtab->items;
@@ -247,6 +247,8 @@ int enable_builtin(int argc, char **argv)
             /* enable the builtin */
             utility->flags |=  BUILTIN_ENABLED;
         }
+        /* commands with this name need to be resolved again */
+        cmd_cache_epoch++;
     }
     return res;
 }
@@ -68,6 +68,7 @@ int eval_builtin(int argc, char **argv)
     src.buffer   = cmd;
     src.bufsize  = strlen(cmd);
     src.srctype  = SOURCE_EVAL;
+    src.buftype  = SOURCE_BUF_BORROWED;
     src.curpos   = INIT_SRC_POS;
     src.srcname  = NULL;
     src.curline  = 1;
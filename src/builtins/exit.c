@@ -167,24 +167,24 @@ void exit_gracefully(int stat, char *errmsg)
         if(read_file("~/.lshlogout", &src))
         {
             parse_and_execute(&src);
-            free(src.buffer);
+            free_source_buffer(&src);
         }
         else if(read_file("~/.logout", &src))
         {
             parse_and_execute(&src);
-            free(src.buffer);
+            free_source_buffer(&src);
         }
 
         /* global logout scripts */
         if(read_file("/etc/lshlogout", &src))
         {
             parse_and_execute(&src);
-            free(src.buffer);
+            free_source_buffer(&src);
         }
         else if(read_file("/etc/logout", &src))
         {
             parse_and_execute(&src);
-            free(src.buffer);
+            free_source_buffer(&src);
         }
 
         sigprocmask(SIG_UNBLOCK, &intmask, NULL);
@@ -29,12 +29,18 @@
 #include "builtins.h"
 #include "../cmd.h"
 #include "../symtab/symtab.h"
+#include "../symtab/string_hash.h"
 #include "../parser/node.h"
 #include "../parser/parser.h"
 #include "../debug.h"
 
+extern char **environ;
+
 #define UTILITY             "export"
 
+static void export_table(struct symtab_s *symtab, int force_export_all,
+                         struct hashtab_s *envtab, uint64_t *sig);
+
 
 /*
  * Print all variables and functions whose flags field contains the given
@@ -62,6 +68,7 @@ void print_var_attribs(unsigned int attr, char *var_perfix, char *func_prefix)
 
 #ifdef USE_HASH_TABLES
 
+        finish_symtab_rehash(symtab);
         if(symtab->used)
         {
             struct symtab_entry_s **h1 = symtab->items;
@@ -330,6 +337,53 @@ int export_builtin(int argc, char **argv)
 }
 
 
+/*
+ * Fold a string into a signature of the exported variables (see get_export_envp()
+ * below). We use 64-bit FNV-1a hashing.
+ */
+static inline uint64_t sig_str(uint64_t sig, char *str)
+{
+    unsigned char *s = (unsigned char *)str;
+    do
+    {
+        sig = (sig ^ *s) * 0x100000001b3ULL;
+    } while(*s++);
+    return sig;
+}
+
+
+/*
+ * Fold a number into a signature of the exported variables.
+ */
+static inline uint64_t sig_num(uint64_t sig, uint64_t num)
+{
+    return (sig ^ num) * 0x100000001b3ULL;
+}
+
+
+/*
+ * Export a name/value pair. If sig is not NULL, the pair is folded into the
+ * signature *sig. Otherwise, if envtab is NULL, the pair is added to our
+ * environment, or to the envtab hashtable if it's not NULL (see
+ * get_export_envp() below).
+ */
+static inline void export_var(struct hashtab_s *envtab, uint64_t *sig, char *name, char *val)
+{
+    if(sig)
+    {
+        *sig = sig_str(sig_str(*sig, name), val);
+    }
+    else if(envtab)
+    {
+        add_hash_item(envtab, name, val);
+    }
+    else
+    {
+        setenv(name, val, 1);
+    }
+}
+
+
 /*
  * Export the contents of the given symbol table to the enviroment of a newly
  * forked process. We export only the variables and functions that have the
@@ -342,6 +396,18 @@ int export_builtin(int argc, char **argv)
  * functions, local and global.
  */
 void do_export_table(struct symtab_s *symtab, int force_export_all)
+{
+    export_table(symtab, force_export_all, NULL, NULL);
+}
+
+
+/*
+ * Do the actual work of do_export_table(). If envtab is not NULL, we add the
+ * exported variables and functions to envtab, instead of our environment. If
+ * sig is not NULL, we only fold them into the signature *sig.
+ */
+static void export_table(struct symtab_s *symtab, int force_export_all,
+                         struct hashtab_s *envtab, uint64_t *sig)
 {
     /* sanity check */
     if(!symtab)
@@ -351,6 +417,7 @@ void do_export_table(struct symtab_s *symtab, int force_export_all)
     
 #ifdef USE_HASH_TABLES
     
+    finish_symtab_rehash(symtab);
     if(symtab->used)
     {
         struct symtab_entry_s **h1 = symtab->items;
@@ -383,7 +450,17 @@ void do_export_table(struct symtab_s *symtab, int force_export_all)
                     if(!entry->val)
                     {
                         /* entry is an exported function */
-                        if(entry->val_type == SYM_FUNC)
+                        if(entry->val_type == SYM_FUNC && sig)
+                        {
+                            /*
+                             * Don't convert the function body to a string just to get
+                             * a signature. Function bodies are only replaced when
+                             * cmd_cache_epoch is bumped, so use that instead.
+                             */
+                            *sig = sig_num(sig_str(*sig, entry->name), (uintptr_t)entry->func_body);
+                            *sig = sig_num(*sig, cmd_cache_epoch);
+                        }
+                        else if(entry->val_type == SYM_FUNC)
                         {
                             char *f = cmd_nodetree_to_str(entry->func_body, 1);
                             if(f)
@@ -391,12 +468,12 @@ void do_export_table(struct symtab_s *symtab, int force_export_all)
                                 char *s = malloc(strlen(f)+10);
                                 if(!s)
                                 {
-                                    setenv(entry->name, "", 1);
+                                    export_var(envtab, NULL, entry->name, "");
                                 }
                                 else
                                 {
                                     sprintf(s, "()\n{\n%s\n}", f);
-                                    setenv(entry->name, s, 1);
+                                    export_var(envtab, NULL, entry->name, s);
                                     //exit_gracefully(0, 0);
                                     free(s);
                                 }
@@ -407,7 +484,7 @@ void do_export_table(struct symtab_s *symtab, int force_export_all)
                     else
                     {
                         /* entry is an exported variable */
-                        setenv(entry->name, entry->val, 1);
+                        export_var(envtab, sig, entry->name, entry->val);
                     }
                 }
                 /* check the next entry */
@@ -452,3 +529,198 @@ void do_export_vars(int force_export_all)
      */
     do_export_table(func_table, force_export_all);
 }
+
+
+/*
+ * The environment we pass to new commands, and the signature of the exported
+ * variables and functions it was built from (see get_export_envp()). The first
+ * slot is reserved for $_, which changes with every command.
+ */
+static char   **envp_cache = NULL;
+static uint64_t envp_cache_sig = 0;
+
+
+/*
+ * Calculate the signature of the environment new commands would get, that is,
+ * the strings of our environment, and the exported variables and functions.
+ */
+static uint64_t export_signature(void)
+{
+    uint64_t sig = 0xcbf29ce484222325ULL;
+    char **e = environ;
+    for( ; *e; e++)
+    {
+        sig = sig_str(sig, *e);
+    }
+    int i = 0;
+    struct symtab_stack_s *stack = get_symtab_stack();
+    for( ; i < stack->symtab_count; i++)
+    {
+        export_table(stack->symtab_list[i], 0, NULL, &sig);
+    }
+    export_table(func_table, 0, NULL, &sig);
+    return sig;
+}
+
+
+/*
+ * Build the environment of a new command, without touching our own environment.
+ * This is what the command's environment would look like after we fork and call
+ * do_export_vars(EXPORT_VARS_EXPORTED_ONLY) in the child process.
+ *
+ * Returns a NULL-terminated array of "name=value" strings, or NULL on error.
+ * The first slot is reserved for $_.
+ */
+static char **build_export_envp(void)
+{
+    struct hashtab_s *envtab = new_hashtable();
+    if(!envtab)
+    {
+        return NULL;
+    }
+
+    /* collect the exported variables and functions (see do_export_vars()) */
+    int i = 0;
+    struct symtab_stack_s *stack = get_symtab_stack();
+    for( ; i < stack->symtab_count; i++)
+    {
+        export_table(stack->symtab_list[i], 0, envtab, NULL);
+    }
+    export_table(func_table, 0, envtab, NULL);
+    /* $_ gets its own slot */
+    rem_hash_item(envtab, "_");
+
+    /* count our environment's strings */
+    int count = 0;
+    char **e = environ;
+    while(*e)
+    {
+        count++, e++;
+    }
+
+    char **envp = malloc((count+envtab->used+2) * sizeof(char *));
+    if(!envp)
+    {
+        free_hashtable(envtab);
+        return NULL;
+    }
+    envp[0] = NULL;
+
+    /* copy the strings of our environment, except those we're overriding */
+    int j = 1;
+    for(e = environ; *e; e++)
+    {
+        char *eq = strchr(*e, '=');
+        if(eq)
+        {
+            char name[eq-*e+1];
+            strncpy(name, *e, eq-*e);
+            name[eq-*e] = '\0';
+            if(strcmp(name, "_") == 0 || get_hash_item(envtab, name))
+            {
+                continue;
+            }
+        }
+        if((envp[j] = __get_malloced_str(*e)))
+        {
+            j++;
+        }
+    }
+
+    /* and add the exported name/value pairs */
+    finish_hash_rehash(envtab);
+    if(envtab->used)
+    {
+        struct hashitem_s **h1 = envtab->items;
+        struct hashitem_s **h2 = envtab->items + envtab->size;
+        for( ; h1 < h2; h1++)
+        {
+            struct hashitem_s *entry = *h1;
+            while(entry)
+            {
+                char *s = malloc(strlen(entry->name)+strlen(entry->val)+2);
+                if(s)
+                {
+                    sprintf(s, "%s=%s", entry->name, entry->val);
+                    envp[j++] = s;
+                }
+                entry = entry->next;
+            }
+        }
+    }
+    envp[j] = NULL;
+    free_hashtable(envtab);
+    return envp;
+}
+
+
+/*
+ * Free an environment array returned by build_export_envp().
+ */
+static void free_export_envp(char **envp)
+{
+    if(!envp)
+    {
+        return;
+    }
+    if(envp[0])
+    {
+        free(envp[0]);
+    }
+    char **e = envp+1;
+    while(*e)
+    {
+        free(*e++);
+    }
+    free(envp);
+}
+
+
+/*
+ * Return the environment of a new command, which we can pass to execve() or
+ * posix_spawn(), instead of modifying our environment with do_export_vars()
+ * in the child process.
+ *
+ * We keep the environment we built last time, along with a signature of the
+ * strings it was built from, and only build it again if the signature changes
+ * (that is, if an exported variable or function, or our environment, changed).
+ * Calculating the signature doesn't alloc memory, and doesn't convert exported
+ * functions to strings, which makes it much cheaper than building the array.
+ *
+ * If underscore is not NULL, it is used as the value of $_ (the pathname of the
+ * command, see do_exec_cmd()). The returned array belongs to us, and is only
+ * valid until the next call to this function.
+ */
+char **get_export_envp(char *underscore)
+{
+    uint64_t sig = export_signature();
+    if(!envp_cache || sig != envp_cache_sig)
+    {
+        free_export_envp(envp_cache);
+        envp_cache = build_export_envp();
+        envp_cache_sig = sig;
+        if(!envp_cache)
+        {
+            return NULL;
+        }
+    }
+
+    /* set $_ */
+    if(envp_cache[0])
+    {
+        free(envp_cache[0]);
+        envp_cache[0] = NULL;
+    }
+    if(!underscore)
+    {
+        return envp_cache+1;
+    }
+    char *s = malloc(strlen(underscore)+3);
+    if(!s)
+    {
+        return envp_cache+1;
+    }
+    sprintf(s, "_=%s", underscore);
+    envp_cache[0] = s;
+    return envp_cache;
+}
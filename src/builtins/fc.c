@@ -194,6 +194,7 @@ void fc_exec_commands(size_t first, size_t last, struct replace_str_s *replace_s
         {
             src.bufsize  = strlen(src.buffer)-1;
             src.srctype  = SOURCE_FCCMD;
+            src.buftype  = SOURCE_BUF_BORROWED;
             src.srcname  = NULL;
             src.curpos   = INIT_SRC_POS;
 
@@ -703,6 +704,7 @@ int fc_builtin(int argc, char **argv)
             src.buffer   = cmd;
             src.bufsize  = strlen(cmd)-1;
             src.srctype  = SOURCE_FCCMD;
+            src.buftype  = SOURCE_BUF_BORROWED;
             src.srcname  = NULL;
             src.curpos   = INIT_SRC_POS;
             parse_and_execute(&src);
@@ -339,6 +339,7 @@ int hash_builtin(int argc, char **argv)
 int rehash_all(void)
 {
     int res = 0;
+    finish_hash_rehash(utility_hashtable);
     if(utility_hashtable->used)
     {
         struct hashitem_s **h1 = utility_hashtable->items;
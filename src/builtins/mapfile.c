@@ -0,0 +1,364 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2020 (c)
+ *
+ *    file: mapfile.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "../cmd.h"
+#include "../symtab/symtab.h"
+#include "../parser/parser.h"
+#include "../debug.h"
+
+#define UTILITY             "mapfile"
+
+/* size of the blocks we read input in */
+#define MAPFILE_BUF_SIZE    65536
+
+
+#define CHECK_OPTION_HAS_ARG(c)                             \
+if(!internal_optarg || internal_optarg == INVALID_OPTARG)   \
+{                                                           \
+    PRINT_ERROR("%s: missing argument to option -%c\n",     \
+                UTILITY, c);                                \
+    return 2;                                               \
+}
+
+
+/*
+ * Set the value of the shell variable whose name is prefix, followed by the
+ * decimal index. The name buffer must be large enough to hold the prefix,
+ * followed by the index.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+static int mapfile_set_var(char *name, char *prefix, long index, char *val)
+{
+    sprintf(name, "%s%ld", prefix, index);
+
+    struct symtab_entry_s *entry = get_symtab_entry(name);
+    if(!entry)
+    {
+        entry = add_to_symtab(name);
+    }
+
+    /* we can't save input in a readonly variable */
+    if(!entry || flag_set(entry->flags, FLAG_READONLY))
+    {
+        READONLY_ASSIGN_ERROR(UTILITY, name, "variable");
+        return 0;
+    }
+
+    symtab_entry_setval(entry, val);
+    return 1;
+}
+
+
+/*
+ * The mapfile (or readarray) builtin utility (non-POSIX). Used to read lines
+ * from standard input (or another file descriptor) into a list of variables.
+ *
+ * As we don't have array variables, line number N is stored in the variable
+ * whose name is formed by appending N to the given name (or MAPFILE if no name
+ * is given), i.e. MAPFILE0, MAPFILE1, and so on. The index that follows the
+ * last line read is stored in the variable formed by appending "_count" to
+ * the name, i.e. MAPFILE_count.
+ *
+ * Unlike read, which reads input one char at a time, we read input in large
+ * blocks and split it into lines in one pass. If we were asked to read a
+ * specific number of lines, and the input is not a regular file that we can
+ * seek back into, we read one char at a time, so that we don't consume input
+ * beyond the last line we read.
+ *
+ * The mapfile and readarray utilities are bash non-POSIX extensions.
+ *
+ * Returns 0 on success, non-zero on error.
+ *
+ * See the manpage for the list of options and an explanation of what each option does.
+ * You can also run: `help mapfile` or `mapfile -h` from lsh prompt to see a short
+ * explanation on how to use this utility.
+ */
+
+int mapfile_builtin(int argc, char **argv)
+{
+    int v = 1, c;
+    /* if set, remove the trailing delimiter from each line */
+    int trim = 0;
+    /* the char that terminates each line */
+    char delim = '\n';
+    /* max number of lines to store (0 means all lines) */
+    long max = 0;
+    /* number of lines to discard before storing lines */
+    long skip = 0;
+    /* index of the first variable we store a line in */
+    long origin = 0;
+    /* file descriptor to read from */
+    int infd = 0;
+    char *strend = NULL;
+    struct builtin_s *utility = strcmp(argv[0], "readarray") ? &MAPFILE_BUILTIN :
+                                                               &READARRAY_BUILTIN;
+
+    /****************************
+     * process the options
+     ****************************/
+    while((c = parse_args(argc, argv, "hvd:n:O:s:tu:", &v,
+                          FLAG_ARGS_ERREXIT|FLAG_ARGS_PRINTERR)) > 0)
+    {
+        switch(c)
+        {
+            case 'h':
+                print_help(argv[0], utility, 0);
+                return 0;
+
+            case 'v':
+                printf("%s", shell_ver);
+                return 0;
+
+            /* lines end in the 1st char of internal_optarg, instead of newline */
+            case 'd':
+                CHECK_OPTION_HAS_ARG(c);
+                delim = *internal_optarg;
+                break;
+
+            /* max. number of lines to store, and number of lines to skip */
+            case 'n':
+            case 's':
+                CHECK_OPTION_HAS_ARG(c);
+                if(c == 'n')
+                {
+                    max = strtol(internal_optarg, &strend, 10);
+                }
+                else
+                {
+                    skip = strtol(internal_optarg, &strend, 10);
+                }
+
+                if(*strend || max < 0 || skip < 0)
+                {
+                    PRINT_ERROR("%s: invalid count: %s\n", UTILITY, internal_optarg);
+                    return 2;
+                }
+                break;
+
+            /* index of the first line */
+            case 'O':
+                CHECK_OPTION_HAS_ARG(c);
+                origin = strtol(internal_optarg, &strend, 10);
+                if(*strend || origin < 0)
+                {
+                    PRINT_ERROR("%s: invalid origin: %s\n", UTILITY, internal_optarg);
+                    return 2;
+                }
+                break;
+
+            /* remove the delimiter */
+            case 't':
+                trim = 1;
+                break;
+
+            /* alternate input file */
+            case 'u':
+                CHECK_OPTION_HAS_ARG(c);
+                infd = strtol(internal_optarg, &strend, 10);
+                if(*strend || fcntl(infd, F_GETFD, 0) == -1)
+                {
+                    PRINT_ERROR("%s: invalid file descriptor: %s\n", UTILITY, internal_optarg);
+                    return 2;
+                }
+                break;
+        }
+    }
+
+    /* unknown option */
+    if(c == -1)
+    {
+        return 2;
+    }
+
+    /* check we have a valid variable name */
+    char *prefix = (v < argc) ? argv[v] : "MAPFILE";
+    if(v < argc-1)
+    {
+        PRINT_ERROR("%s: too many arguments\n", UTILITY);
+        return 2;
+    }
+
+    if(!is_name(prefix))
+    {
+        PRINT_ERROR("%s: invalid name: %s\n", UTILITY, prefix);
+        return 1;
+    }
+
+    /* buffer to hold variable names (the prefix, followed by the index or "_count") */
+    char name[strlen(prefix)+32];
+
+    /*
+     * If we have a max count of lines to read, we can read ahead only if we can
+     * seek back when we're done. Otherwise we'll consume input that belongs to
+     * the next command to read from the same file.
+     */
+    struct stat st;
+    int seekable = (fstat(infd, &st) == 0 && S_ISREG(st.st_mode) &&
+                    lseek(infd, 0, SEEK_CUR) != -1);
+    size_t chunk = (max && !seekable) ? 1 : MAPFILE_BUF_SIZE;
+
+    /* leave room for an extra char after the last line (see below) */
+    size_t buf_size = MAPFILE_BUF_SIZE;
+    char *buf = malloc(buf_size+1);
+    if(!buf)
+    {
+        PRINT_ERROR("%s: failed to allocate buffer: %s\n", UTILITY, strerror(errno));
+        return 1;
+    }
+
+    /*
+     * len is the count of chars in the buffer, start is the index of the first
+     * char of the line we haven't finished reading yet.
+     */
+    size_t len = 0, start = 0;
+    long stored = 0;
+    int res = 0, done = 0;
+
+    while(!done)
+    {
+        /* make room for the next block, shifting the unfinished line to the front */
+        if(len+chunk > buf_size)
+        {
+            if(start)
+            {
+                memmove(buf, buf+start, len-start);
+                len -= start;
+                start = 0;
+            }
+
+            if(len+chunk > buf_size)
+            {
+                char *buf2 = realloc(buf, (buf_size*2)+1);
+                if(!buf2)
+                {
+                    PRINT_ERROR("%s: failed to allocate buffer: %s\n", UTILITY, strerror(errno));
+                    res = 1;
+                    break;
+                }
+                buf = buf2;
+                buf_size *= 2;
+            }
+        }
+
+        ssize_t n = read(infd, buf+len, chunk);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            PRINT_ERROR("%s: failed to read: %s\n", UTILITY, strerror(errno));
+            res = 1;
+            break;
+        }
+
+        /* EOF. store the last line, which doesn't end in a delimiter */
+        if(n == 0)
+        {
+            if(start < len && !skip)
+            {
+                buf[len] = '\0';
+                if(mapfile_set_var(name, prefix, origin+stored, buf+start))
+                {
+                    stored++;
+                }
+                else
+                {
+                    res = 1;
+                }
+            }
+            start = len;
+            break;
+        }
+
+        char *scan = buf+len;
+        len += n;
+        char *end = buf+len;
+
+        /* store all the complete lines we have in the buffer */
+        char *p;
+        while((p = memchr(scan, delim, end-scan)))
+        {
+            char *line = buf+start;
+            start = (p+1)-buf;
+            scan = p+1;
+
+            if(skip)
+            {
+                skip--;
+                continue;
+            }
+
+            /* terminate the line, which might overwrite the first char of the next line */
+            char *line_end = trim ? p : p+1;
+            char saved = *line_end;
+            *line_end = '\0';
+
+            if(!mapfile_set_var(name, prefix, origin+stored, line))
+            {
+                res = 1;
+                done = 1;
+                break;
+            }
+            *line_end = saved;
+
+            if(++stored == max)
+            {
+                done = 1;
+                break;
+            }
+        }
+    }
+
+    /* give back any input we read past the last line we stored */
+    if(seekable && start < len)
+    {
+        lseek(infd, -(off_t)(len-start), SEEK_CUR);
+    }
+
+    free(buf);
+
+    /* save the index that follows the last line */
+    sprintf(name, "%s_count", prefix);
+    struct symtab_entry_s *entry = get_symtab_entry(name);
+    if(!entry)
+    {
+        entry = add_to_symtab(name);
+    }
+
+    if(entry && !flag_set(entry->flags, FLAG_READONLY))
+    {
+        sprintf(name, "%ld", origin+stored);
+        symtab_entry_setval(entry, name);
+    }
+
+    return res;
+}
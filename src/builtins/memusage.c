@@ -27,6 +27,7 @@
 #include "../symtab/symtab.h"
 #include "../symtab/string_hash.h"
 #include "../parser/node.h"
+#include "../astcache.h"
 #include "../debug.h"
 
 #define UTILITY         "memusage"
@@ -50,9 +51,24 @@ void print_mu_cmdbuf(void);
 void print_mu_dirstack(int lengthy);
 void print_mu_vm(int lengthy);
 void print_mu_aliases(void);
+void print_mu_nodes(int lengthy);
+void print_mu_source_cache(int lengthy);
 
 void output_size(long long __size);
 
+/* hash chain statistics of one or more hash tables */
+struct chain_stats_s
+{
+    long   buckets;         /* total number of buckets */
+    long   used_buckets;    /* number of non-empty buckets */
+    long   entries;         /* total number of entries */
+    long   longest;         /* length of the longest chain */
+};
+
+void chain_stats_symtab(struct symtab_s *symtab, struct chain_stats_s *stats);
+void chain_stats_hashtab(struct hashtab_s *hashtab, struct chain_stats_s *stats);
+void print_chain_stats(struct chain_stats_s *stats);
+
 /* defined in trap.c */
 extern struct trap_item_s trap_table[];
 
@@ -121,6 +137,8 @@ int memusage_builtin(int argc, char **argv)
         print_mu_str_hashtab(lengthy);
         print_mu_dirstack(lengthy);
         print_mu_aliases();
+        print_mu_nodes(lengthy);
+        print_mu_source_cache(lengthy);
         print_mu_traps();
         print_mu_inputbuf();
         print_mu_history();
@@ -172,6 +190,14 @@ int memusage_builtin(int argc, char **argv)
         {
             print_mu_aliases();
         }
+        else if(strcmp(arg, "nodes") == 0 || strcmp(arg, "ast") == 0)
+        {
+            print_mu_nodes(lengthy);
+        }
+        else if(strcmp(arg, "srccache") == 0 || strcmp(arg, "sourcecache") == 0)
+        {
+            print_mu_source_cache(lengthy);
+        }
     }
     /* return success */
     return 0;
@@ -236,7 +262,7 @@ void print_mu_dirstack(int lengthy)
  */
 void print_mu_stack(int lengthy)
 {
-    long long res[3];
+    long long res[4];
     long long i = memusage_symtab_stack(res);
     printf("* Symbol table stack: ");
     if(!lengthy)
@@ -249,6 +275,27 @@ void print_mu_stack(int lengthy)
         printf("\n  - stack structure: "); output_size(res[0]);
         printf("\n  - symbol names and values (strings): "); output_size(res[1]);
         printf("\n  - function definitions: "); output_size(res[2]);
+        printf("\n  - pool of recycled symbol tables: "); output_size(res[3]);
+        
+#ifdef USE_HASH_TABLES
+
+        struct symtab_pool_s *pool = get_symtab_pool();
+        printf("\n    (%d tables, %ld hits, %ld misses)", pool->count, pool->hits, pool->misses);
+
+        struct symtab_lookup_cache_s *cache = get_symtab_lookup_cache();
+        printf("\n  - lookup cache: %ld hits, %ld misses", cache->hits, cache->misses);
+
+        struct chain_stats_s stats = { 0, 0, 0, 0 };
+        struct symtab_stack_s *stack = get_symtab_stack();
+        int j;
+        for(j = 0; j < stack->symtab_count; j++)
+        {
+            chain_stats_symtab(stack->symtab_list[j], &stats);
+        }
+        print_chain_stats(&stats);
+
+#endif
+
         printf("\n");
     }
 }
@@ -271,6 +318,9 @@ void print_mu_hashtab(int lengthy)
     {
         printf("\n  - hashtable structure: "); output_size(res[0]);
         printf("\n  - utility names and paths (strings): "); output_size(res[1]);
+        struct chain_stats_s stats = { 0, 0, 0, 0 };
+        chain_stats_hashtab(utility_hashtable, &stats);
+        print_chain_stats(&stats);
         printf("\n");
     }
 }
@@ -293,6 +343,9 @@ void print_mu_str_hashtab(int lengthy)
     {
         printf("\n  - hashtable structure: "); output_size(res[0]);
         printf("\n  - string values: "); output_size(res[1]);
+        struct chain_stats_s stats = { 0, 0, 0, 0 };
+        chain_stats_hashtab(str_hashes, &stats);
+        print_chain_stats(&stats);
         printf("\n");
     }
 }
@@ -337,6 +390,46 @@ void print_mu_aliases(void)
 }
 
 
+/*
+ * Print the memory used for the parse trees of the commands we are executing
+ * (function definitions are counted with the symbol table stack).
+ */
+void print_mu_nodes(int lengthy)
+{
+    long long i = node_arena_blocks * (long long)sizeof(struct node_arena_block_s);
+    printf("* Parse trees (node arenas): ");
+    output_size(i);
+    if(lengthy)
+    {
+        printf("\n  - node arena blocks: %ld (%d nodes each)",
+               node_arena_blocks, NODE_ARENA_BLOCK_NODES);
+        printf("\n  - nodes created so far: %ld (", node_count);
+        output_size(node_count * (long long)sizeof(struct node_s));
+        printf(", %d bytes per node)", (int)sizeof(struct node_s));
+    }
+    printf("\n");
+}
+
+
+/*
+ * Print the memory used for the parse trees of the dot files we keep in the
+ * source cache.
+ */
+void print_mu_source_cache(int lengthy)
+{
+    printf("* Source cache (parsed dot files): ");
+    output_size(source_cache.size);
+    if(lengthy)
+    {
+        printf("\n  - cached files: %ld (limit ", source_cache.count);
+        output_size(get_shell_varl("SOURCECACHESIZE", SOURCE_CACHE_DEFAULT_SIZE) * 1024LL);
+        printf(")");
+        printf("\n  - lookups: %ld hits, %ld misses", source_cache.hits, source_cache.misses);
+    }
+    printf("\n");
+}
+
+
 /*
  * Print the memory used for the history list.
  */
@@ -397,6 +490,7 @@ long long memusage_symtab_stack(long long *res)
     res[0] = sizeof(struct symtab_stack_s);
     res[1] = 0;
     res[2] = 0;
+    res[3] = 0;
     struct symtab_stack_s *stack = get_symtab_stack();
     for(i = 0; i < stack->symtab_count; i++)
     {
@@ -408,7 +502,19 @@ long long memusage_symtab_stack(long long *res)
             res[2] += res2[2];      /* memory used by function definitions */
         }
     }
-    return res[0]+res[1]+res[2];
+    
+#ifdef USE_HASH_TABLES
+
+    /* memory used by the empty tables we keep for reuse */
+    struct symtab_pool_s *pool = get_symtab_pool();
+    for(i = 0; i < pool->count; i++)
+    {
+        res[3] += memusage_symtab(pool->tables[i], NULL);
+    }
+
+#endif
+
+    return res[0]+res[1]+res[2]+res[3];
 }
 
 
@@ -425,7 +531,11 @@ long long memusage_symtab(struct symtab_s *symtab, long long *__res)
     
 #ifdef USE_HASH_TABLES
     
-    res[0] += symtab->size * sizeof(struct symtab_entry_s *);
+    finish_symtab_rehash(symtab);
+    if(symtab->items)
+    {
+        res[0] += symtab->size * sizeof(struct symtab_entry_s *);
+    }
     if(symtab->used)
     {
         struct symtab_entry_s **h1 = symtab->items;
@@ -490,6 +600,7 @@ long long memusage_hashtab(struct hashtab_s *hashtab, long long *__res, int addv
         return 0;
     }
     long long res[3];
+    finish_hash_rehash(hashtab);
     res[0] = sizeof(struct hashtab_s);
     res[0] += hashtab->size * sizeof(struct hashitem_s *);
     res[1] = 0;
@@ -538,6 +649,15 @@ long long memusage_node(struct node_s *node, long long *__res)
     long long res[2];
     res[0] = sizeof(struct node_s);
     res[1] = 0;
+    /* add the cached command resolution, if any */
+    if(node->cmd_cache)
+    {
+        res[0] += sizeof(struct cmd_cache_s);
+        if(node->cmd_cache->name)
+        {
+            res[1] += strlen(node->cmd_cache->name)+1;
+        }
+    }
     struct node_s *child = node->first_child;
     while(child)
     {
@@ -635,6 +755,98 @@ long long memusage_history(long long *__res)
     return res;
 }
 
+/*
+ * Add the hash chain statistics of the given symbol table to *stats.
+ */
+void chain_stats_symtab(struct symtab_s *symtab, struct chain_stats_s *stats)
+{
+    if(!symtab)
+    {
+        return;
+    }
+
+#ifdef USE_HASH_TABLES
+
+    finish_symtab_rehash(symtab);
+    if(!symtab->items)
+    {
+        return;
+    }
+    stats->buckets += symtab->size;
+    struct symtab_entry_s **h1 = symtab->items;
+    struct symtab_entry_s **h2 = symtab->items + symtab->size;
+    for( ; h1 < h2; h1++)
+    {
+        long len = 0;
+        struct symtab_entry_s *entry = *h1;
+        while(entry)
+        {
+            len++;
+            entry = entry->next;
+        }
+        if(len)
+        {
+            stats->used_buckets++;
+            stats->entries += len;
+            if(len > stats->longest)
+            {
+                stats->longest = len;
+            }
+        }
+    }
+
+#endif
+
+}
+
+
+/*
+ * Add the hash chain statistics of the given hash table to *stats.
+ */
+void chain_stats_hashtab(struct hashtab_s *hashtab, struct chain_stats_s *stats)
+{
+    if(!hashtab || !hashtab->items)
+    {
+        return;
+    }
+    finish_hash_rehash(hashtab);
+    stats->buckets += hashtab->size;
+    struct hashitem_s **h1 = hashtab->items;
+    struct hashitem_s **h2 = hashtab->items + hashtab->size;
+    for( ; h1 < h2; h1++)
+    {
+        long len = 0;
+        struct hashitem_s *entry = *h1;
+        while(entry)
+        {
+            len++;
+            entry = entry->next;
+        }
+        if(len)
+        {
+            stats->used_buckets++;
+            stats->entries += len;
+            if(len > stats->longest)
+            {
+                stats->longest = len;
+            }
+        }
+    }
+}
+
+
+/*
+ * Print hash chain statistics.
+ */
+void print_chain_stats(struct chain_stats_s *stats)
+{
+    printf("\n  - hash chains: %ld entries in %ld buckets (%ld used)",
+           stats->entries, stats->buckets, stats->used_buckets);
+    printf("\n    (longest chain: %ld, average chain: %.2f)", stats->longest,
+           stats->used_buckets ? (double)stats->entries/stats->used_buckets : 0.0);
+}
+
+
 /*
  * Output byte size in a properly formatted way.
  */
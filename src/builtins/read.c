@@ -60,6 +60,86 @@ int is_fifo(int fd)
 }
 
 
+/*
+ * Input buffer used by read when the input file is seekable (see read_char()).
+ */
+#define READ_BUF_SIZE       4096
+
+struct read_buf_s
+{
+    int   fd;           /* the file descriptor we're reading from */
+    int   seekable;     /* if set, we can read ahead and seek back later */
+    char *ptr;          /* next unconsumed char in buf */
+    char *end;          /* end of the valid chars in buf */
+    char  buf[READ_BUF_SIZE];
+};
+
+
+/*
+ * Initialize the input buffer rb to read from file descriptor fd.
+ *
+ * We can only read ahead if the input is a regular file, as we can seek back
+ * to the end of the chars we actually consumed when we are done. Other types
+ * of input (terminals, pipes, sockets) are shared with the commands we run
+ * after read returns, e.g. the 'cat' in 'while read x; do cat; done', which
+ * would lose any input we read ahead of the delimiter. For these, we have to
+ * read one char at a time.
+ */
+static void init_read_buf(struct read_buf_s *rb, int fd, int reading_tty)
+{
+    struct stat st;
+    rb->fd = fd;
+    rb->seekable = !reading_tty && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                   lseek(fd, 0, SEEK_CUR) != -1;
+    rb->ptr = rb->buf;
+    rb->end = rb->buf;
+}
+
+
+/*
+ * Read the next input char from rb into c.
+ *
+ * Returns 1 if a char was read, 0 on EOF, -1 on error (similar to read()).
+ */
+static inline int read_char(struct read_buf_s *rb, char *c)
+{
+    if(!rb->seekable)
+    {
+        return read(rb->fd, c, 1);
+    }
+
+    if(rb->ptr == rb->end)
+    {
+        ssize_t n = read(rb->fd, rb->buf, READ_BUF_SIZE);
+        if(n <= 0)
+        {
+            return n;
+        }
+        rb->ptr = rb->buf;
+        rb->end = rb->buf+n;
+    }
+
+    (*c) = *rb->ptr++;
+    return 1;
+}
+
+
+/*
+ * Give back the chars we read ahead but didn't consume, by seeking back to the
+ * position right after the last char we consumed, so that the next command to
+ * read from the file will start where we stopped.
+ */
+static void release_read_buf(struct read_buf_s *rb)
+{
+    if(rb->seekable && rb->ptr != rb->end)
+    {
+        lseek(rb->fd, -(off_t)(rb->end - rb->ptr), SEEK_CUR);
+    }
+    rb->ptr = rb->buf;
+    rb->end = rb->buf;
+}
+
+
 /*
  * Determine if input is available on stdin, which should be the terminal or
  * a FIFO (named pipe).
@@ -550,8 +630,10 @@ int read_builtin(int argc, char **argv)
     int count = 0, skip_next = 0;
     char *b = buf;
     char *bend = b+buf_size-1;
+    struct read_buf_s rb;
+    init_read_buf(&rb, infd, reading_tty);
 
-    while((c = read(infd, b, 1)) == 1)
+    while((c = read_char(&rb, b)) == 1)
     {
         /* EOF */
         if(*b == 0x04)
@@ -612,6 +694,9 @@ int read_builtin(int argc, char **argv)
         }
     }
     
+    /* give back any input we read past the last char we consumed */
+    release_read_buf(&rb);
+    
     if(b)
     {
         *b = '\0';
@@ -540,6 +540,7 @@ int set_builtin(int argc, char **argv)
 
 #ifdef USE_HASH_TABLES
 
+            finish_symtab_rehash(symtab);
             if(symtab->used)
             {
                 struct symtab_entry_s **h1 = symtab->items;
@@ -50,6 +50,7 @@ struct optionx_s
 optionx_list[] =
 {
     { "addsuffix"                   , OPTION_ADD_SUFFIX           },    /* similar to setting tcsh addsuffix variable */
+    { "astcache"                    , OPTION_AST_CACHE            },    /* our extension to cache parsed scripts on disk */
     { "autocd"                      , OPTION_AUTO_CD              },
     { "caller_verbose"              , OPTION_CALLER_VERBOSE       },    /* similar to bash's shift-verbose option, except
                                                                            that it affects the 'caller' builtin */
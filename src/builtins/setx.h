@@ -76,6 +76,7 @@ extern __int64_t optionsx;
 #define OPTION_PROMPT_BANG              0x800000000000l /* (1 << 47) -- zsh-like extension */
 #define OPTION_PROMPT_PERCENT           0x1000000000000l/* (1 << 48) -- zsh-like extension */
 #define OPTION_CALLER_VERBOSE           0x2000000000000l/* (1 << 49) */
+#define OPTION_AST_CACHE                0x4000000000000l/* (1 << 50) */
 
 #define optionx_set(o)                  ((((optionsx) & (o)) == (o)) ? 1 : 0)
 
@@ -25,6 +25,7 @@
 #include "builtins.h"
 #include "../cmd.h"
 #include "setx.h"
+#include "../astcache.h"
 #include "../debug.h"
 
 int do_source_script(char *utility, char *file, int argc, char **argv);
@@ -115,10 +116,11 @@ int do_source_script(char *utility, char *file, int argc, char **argv)
     
     /*
      * we will set src.srcname and src.curline et al. in the call to
-     * read_file() below.
+     * read_file() (or load_source_cache()) below.
      */
     struct source_s src;
     src.buffer  = NULL;
+    src.srcname = NULL;
 
     /* does the dot filename has slashes in it? */
     if(strchr(file, '/'))
@@ -165,8 +167,12 @@ int do_source_script(char *utility, char *file, int argc, char **argv)
         }
     }
         
+    /* if we've sourced the file before, we don't need to read and parse it again */
+    struct ast_cache_s cache;
+    int cached = load_source_cache(path, &src, &cache);
+
     /* try to read the dot file */
-    if(!read_file(path, &src))
+    if(!cached && !read_file(path, &src))
     {
         PRINT_ERROR("%s: failed to read `%s`: %s\n", utility, file, strerror(errno));
         if(path != file)
@@ -204,7 +210,15 @@ int do_source_script(char *utility, char *file, int argc, char **argv)
 
     /* now execute the dot script */
     set_internal_exit_status(0);
-    parse_and_execute(&src);
+    if(cached)
+    {
+        execute_ast_cache(&src, &cache);
+        close_ast_cache(&cache);
+    }
+    else
+    {
+        parse_and_execute(&src);
+    }
     
     /* bash executes RETURN traps when dot script finishes */
     trap_handler(RETURN_TRAP_NUM);
@@ -235,7 +249,11 @@ int do_source_script(char *utility, char *file, int argc, char **argv)
      *       symbol table back in do_simple_command().
      */
 
-    free(src.buffer);
+    free_source_buffer(&src);
+    if(src.srcname)
+    {
+        free_malloced_str(src.srcname);
+    }
 
     /* and return */
     return exit_status;
@@ -415,6 +415,32 @@ void reset_nonignored_traps(void)
 }
 
 
+/*
+ * Fill the given sigset with the signals that reset_nonignored_traps() would
+ * reset to their default action. Used when we posix_spawn() an external command,
+ * as we can't call reset_nonignored_traps() from the command's child process.
+ * Signals that are caught by the shell are reset to their default action by
+ * exec anyway, so we only need to care about signals ignored by the shell.
+ */
+void get_nonignored_traps(sigset_t *sigset)
+{
+    sigemptyset(sigset);
+    int i = 1;
+    for( ; i < SIGNAL_COUNT; i++)
+    {
+        if(trap_table[i].action == ACTION_IGNORE)
+        {
+            continue;
+        }
+        struct sigaction *handler = get_sigaction(i);
+        if(handler->sa_handler == SIG_DFL)
+        {
+            sigaddset(sigset, i);
+        }
+    }
+}
+
+
 /*
  * Print the value of one trap.
  */
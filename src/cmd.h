@@ -26,6 +26,8 @@
 #include <string.h>
 #include <stdint.h>
 #include <termios.h>
+#include <signal.h>
+#include <setjmp.h>
 #include <sys/types.h>
 #include "scanner/source.h"
 
@@ -204,10 +206,18 @@ do                                      \
 
 #include "builtins/builtins.h"
 
-/* POSIX says non-interactive shell should exit on syntax errors */
+/*
+ * POSIX says non-interactive shell should exit on syntax errors. if we might
+ * parse the command again (see parse_streamed_list() in main.c), we jump back
+ * to the caller, which will read more input and try again.
+ */
 #define EXIT_IF_NONINTERACTIVE()                                    \
 do {                                                                \
-        if(!interactive_shell)                                      \
+        if(tentative_parse)                                         \
+        {                                                           \
+            longjmp(tentative_parse_env, 1);                        \
+        }                                                           \
+        else if(!interactive_shell)                                 \
         {                                                           \
             /* try to exit (this will execute any EXIT traps) */    \
             do_builtin_internal(exit_builtin, 2,                    \
@@ -345,6 +355,8 @@ extern  int       shell_level;
 extern  int       read_stdin;                           /* main.c */
 extern  int       interactive_shell;
 extern  int       restricted_shell;
+extern  int       tentative_parse;
+extern  jmp_buf   tentative_parse_env;
 extern  int       signal_received;                      /* sig.c */
 extern  int       tried_exit;                           /* builtins/exit.c */
 #include "symtab/symtab.h"
@@ -361,6 +373,7 @@ extern  int       HISTSIZE;
 extern  char      default_hist_filename[];
 extern  int       executing_trap;                       /* builtins/trap.c */
 extern  char     *cwd;                                  /* builtins/cd.c */
+extern  unsigned long cmd_cache_epoch;                  /* backend/backend.c */
 
 
 /***********************************************
@@ -579,6 +592,7 @@ void    do_posix(int on);
 /* builtins/trap.c */
 void    init_traps(void);
 void    reset_nonignored_traps(void);
+void    get_nonignored_traps(sigset_t *sigset);
 void    trap_handler(int signum);
 struct  trap_item_s *save_trap(char *name);
 void    restore_trap(char *name, struct trap_item_s *saved);
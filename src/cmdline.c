@@ -149,6 +149,7 @@ void cmdline(void)
     src.buffer   = NULL;
     src.bufsize  = 0;
     src.srctype  = SOURCE_STDIN;
+    src.buftype  = SOURCE_BUF_BORROWED;
     src.srcname  = NULL;
     src.curpos   = INIT_SRC_POS;
 
@@ -115,6 +115,8 @@ void print_err(struct error_s *err, char *errstr)
     char *line = get_line(err->src, err->linestart, &tabs);
     if(!line)
     {
+        /* the error is at the end of input, so there's no line to show */
+        fprintf(stderr, err_format, SOURCE_NAME, err->lineno, err->charno, errstr, "");
         return;
     }
     
@@ -77,6 +77,8 @@ struct symtab_entry_s *add_func(char *name)
     entry = add_to_any_symtab(name, func_table);
     if(entry)
     {
+        /* commands with this name are now function calls */
+        cmd_cache_epoch++;
         entry->val_type = SYM_FUNC;
         /*// all functions are marked for export */
     }
@@ -103,6 +105,8 @@ int unset_func(char *name)
         return 0;
     }
     
+    /* commands with this name are not function calls anymore */
+    cmd_cache_epoch++;
     return rem_from_symtab(func, func_table);
 }
 
@@ -121,6 +125,7 @@ void print_func_attribs(unsigned int flag)
 
 #ifdef USE_HASH_TABLES
 
+    finish_symtab_rehash(func_table);
     if(func_table->used)
     {
         struct symtab_entry_s **h1 = func_table->items;
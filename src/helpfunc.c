@@ -41,6 +41,8 @@
 #include "backend/backend.h"
 #include "builtins/builtins.h"
 
+extern char **environ;
+
 /********************************************************************
  * 
  * This file contains helper functions for other parts of the shell.
@@ -252,7 +254,15 @@ int fork_command(int argc, char **argv, char *use_path, char *UTILITY, int flags
         }
 
         /* export variables and execute the command */
-        do_export_vars(EXPORT_VARS_EXPORTED_ONLY);
+        char **envp = get_export_envp(NULL);
+        if(envp)
+        {
+            environ = envp;
+        }
+        else
+        {
+            do_export_vars(EXPORT_VARS_EXPORTED_ONLY);
+        }
         do_exec_cmd(argc, argv, use_path, NULL);
 
         /* NOTE: we should NEVER come back here, unless there is error of course!! */
@@ -407,11 +407,15 @@ int heredoc_delim(char *orig_cmd, int *expand, char **__delim, char **__delim_en
         {
             /* add quoted substring as-is (we'll do quote removal later) */
             size_t i = find_closing_quote(c1, 0, 0);
-            if(i)
+            /*
+             * find_closing_quote() returns the length of the string if it
+             * doesn't find the closing quote, so check we've got one.
+             */
+            if(i && c1[i] == *c1)
             {
                 /* we will not expand this heredoc */
                 (*expand) = 0;
-                char *c3 = orig_cmd+i;
+                char *c3 = c1+i;
                 while(c1 <= c3)
                 {
                     *c2++ = *c1++;
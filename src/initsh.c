@@ -107,7 +107,7 @@ int check_env_file(void)
     /* and execute it */
     parse_and_execute(&src);
     /* free the buffer */
-    free(src.buffer);
+    free_source_buffer(&src);
     return 1;
 }
 
@@ -594,7 +594,7 @@ void init_login(void)
     if(read_file("/etc/profile", &src))
     {
         parse_and_execute(&src);
-        free(src.buffer);
+        free_source_buffer(&src);
     }
     /* ksh disables processing of ~/.profile in the privileged mode */
     if(!option_set('p'))
@@ -603,12 +603,12 @@ void init_login(void)
         if(read_file(".profile", &src))
         {
             parse_and_execute(&src);
-            free(src.buffer);
+            free_source_buffer(&src);
         }
         if(read_file("~/.profile", &src))
         {
             parse_and_execute(&src);
-            free(src.buffer);
+            free_source_buffer(&src);
         }
     }
 
@@ -616,12 +616,12 @@ void init_login(void)
     if(read_file("/etc/lshlogin", &src))
     {
         parse_and_execute(&src);
-        free(src.buffer);
+        free_source_buffer(&src);
     }
     if(read_file("~/.lshlogin", &src))
     {
         parse_and_execute(&src);
-        free(src.buffer);
+        free_source_buffer(&src);
     }
 }
 
@@ -635,13 +635,13 @@ void init_rc(void)
     if(read_file("/etc/lshrc", &src))
     {
         parse_and_execute(&src);
-        free(src.buffer);
+        free_source_buffer(&src);
     }
     /* read the local init script */
     if(!norc && read_file(rcfile, &src))
     {
         parse_and_execute(&src);
-        free(src.buffer);
+        free_source_buffer(&src);
     }
     /* ksh disables executing the $ENV file in the privileged mode */
     if(!option_set('p'))
@@ -653,7 +653,7 @@ void init_rc(void)
             if(!norc && read_file(rcfile, src))
             {
                 do_cmd();
-                free(src->buffer);
+                free_source_buffer(src);
             }
             */
         }
@@ -929,6 +929,7 @@ int parse_shell_args(int argc, char **argv, struct source_s *src)
         /* otherwise, read it */
         src->buffer   = argv[i++];
         src->bufsize  = strlen(src->buffer);
+        src->buftype  = SOURCE_BUF_BORROWED;
         src->srctype  = SOURCE_CMDSTR;
         src->srcname  = NULL;
         src->curpos   = INIT_SRC_POS;
@@ -30,6 +30,8 @@
 #include <errno.h>
 #include <locale.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cmd.h"
 #include "sig.h"
 #include "debug.h"
@@ -38,6 +40,7 @@
 #include "symtab/symtab.h"
 #include "builtins/builtins.h"
 #include "builtins/setx.h"
+#include "astcache.h"
 
 /* pgid of the shell */
 pid_t  shell_pid = 0;
@@ -54,6 +57,14 @@ int    interactive_shell = 0;
 /* flag to indicate whether the shell is restricted or not */
 int    restricted_shell = 0;
 
+/*
+ * flag to indicate we might parse the current command again, so syntax errors
+ * shouldn't cause us to exit, and where to jump to when we get such an error
+ * (see parse_streamed_list()).
+ */
+int     tentative_parse = 0;
+jmp_buf tentative_parse_env;
+
 /* defined in initsh.c */
 extern int   noprofile;        /* if set, do not load login scripts */
 extern int   norc;             /* if set, do not load rc scripts */
@@ -268,12 +279,9 @@ int main(int argc, char **argv)
         }
         else
         {
-            long i;
-            char *tmpbuf = NULL;
-            if((i = read_pipe(stdin, &tmpbuf)))
+            /* read the script in chunks as we parse and execute it */
+            if(init_source_stream(&src, fileno(stdin)))
             {
-                src.buffer   = tmpbuf;
-                src.bufsize  = i;
                 src.srctype  = SOURCE_STDIN;
                 src.srcname  = NULL;
                 src.curpos   = INIT_SRC_POS;
@@ -371,6 +379,291 @@ void do_history_and_print(struct source_s *src, struct node_s *cmd_tree)
 }
 
 
+/*
+ * Parse the next command from a streamed source (see the comment before
+ * init_source_stream() in scanner/source.c). We start from where the scanner was
+ * before it read the current token (see tokenize()), after discarding the text
+ * before the current line, which belongs to commands we've already executed.
+ *
+ * If we read more input while parsing the command, the parser might have scanned
+ * a part of the command before the rest of it was in the buffer. If the parser
+ * hit the end of the buffer before we've read the whole input, the command might
+ * not fit in the buffer. In both cases, we parse the command again, after reading
+ * more input. Error messages are held back until we know that we won't parse the
+ * command again.
+ *
+ * Returns the parsed nodetree, NULL on parsing errors or if there are no more
+ * commands to parse.
+ */
+static struct node_s *parse_streamed_list(struct source_s *src)
+{
+    static FILE  *errfile = NULL;
+    static char  *errbuf = NULL;
+    static size_t errbuf_size = 0;
+    struct token_s *tok = get_current_token();
+    struct node_s *cmd;
+    int final;
+
+    /* the position of the scanner before it read the current token */
+    long curpos = src->curpos_old-1, linestart = tok->linestart;
+    long curline = tok->lineno, curchar = tok->charno;
+
+    /* drop the text we've already executed */
+    long discarded = discard_source_text(src, linestart);
+    curpos    -= discarded;
+    linestart -= discarded;
+
+    if(!errfile)
+    {
+        errfile = open_memstream(&errbuf, &errbuf_size);
+    }
+
+    while(1)
+    {
+        src->curpos       = curpos;
+        src->curline      = curline;
+        src->curchar      = curchar;
+        src->curlinestart = linestart;
+        src->savepos      = (curpos < 0) ? 0 : curpos+1;
+        src->filled       = 0;
+
+        /* hold back error messages if we might have to parse the command again */
+        FILE *saved_stderr = stderr;
+        final = src->eof || !errfile;
+        if(!final)
+        {
+            rewind(errfile);
+            stderr = errfile;
+        }
+
+        parser_err = 0;
+        cmd = NULL;
+        tentative_parse = !final;
+
+        /*
+         * the parser jumps back here if it hits a syntax error while
+         * tentative_parse is set (see EXIT_IF_NONINTERACTIVE() in cmd.h).
+         * the partially parsed nodetree is lost in this case.
+         */
+        if(setjmp(tentative_parse_env))
+        {
+            cmd = NULL;
+            parser_err = 1;
+        }
+        else
+        {
+            /* skip optional newline and comment tokens */
+            tok = tokenize(src);
+            while(tok->type == TOKEN_COMMENT || tok->type == TOKEN_NEWLINE)
+            {
+                tok = tokenize(tok->src);
+            }
+
+            /* save the start of this line */
+            src->wstart = src->curpos-(tok->text_len);
+
+            if(tok->type != TOKEN_EOF)
+            {
+                cmd = parse_list(tok);
+            }
+        }
+        tok = get_current_token();
+        stderr = saved_stderr;
+        tentative_parse = 0;
+
+        /*
+         * a tentative parse that hit the end of input (and maybe a syntax error)
+         * loops once more as a final parse, so that errors are reported normally.
+         */
+        if(!src->filled &&
+           (final || (cmd && !parser_err &&
+                      tok->type != TOKEN_EOF)))
+        {
+            break;
+        }
+
+        /* put back any heredocs the parser cut out, and read more input */
+        if(cmd)
+        {
+            free_node_tree(cmd);
+        }
+        restore_source_text(src);
+
+        if(!src->filled)
+        {
+            if(src->bufsize+1 >= src->bufcap && !grow_source_buffer(src))
+            {
+                PRINT_ERROR("%s: failed to allocate buffer: %s\n", SOURCE_NAME,
+                            strerror(errno));
+                /* parse what we've got */
+                src->eof = 1;
+            }
+            fill_source_buffer(src);
+        }
+    }
+
+    /* now we can print the error messages we've held back */
+    if(!final)
+    {
+        fflush(errfile);
+        long len = ftell(errfile);
+        if(len > 0)
+        {
+            fwrite(errbuf, 1, len, stderr);
+        }
+    }
+
+    if(src->savebuf)
+    {
+        free(src->savebuf);
+        src->savebuf = NULL;
+    }
+
+    return cmd;
+}
+
+
+/*
+ * Prepare the terminal and our standard streams before we execute the commands
+ * of a translation unit.
+ */
+static void begin_executing_cmds(void)
+{
+    /* restore the terminal's canonical mode if needed */
+    if(read_stdin && interactive_shell)
+    {
+        term_canon(1);
+    }
+    
+    /*
+     * backup our standard streams so that we can restore them in case we needed
+     * to execute an EXIT trap any time while we are executing commands.
+     */
+    save_std(0, backup_fd);
+    save_std(1, backup_fd);
+    save_std(2, backup_fd);
+}
+
+
+/*
+ * Clean up after we've executed the commands of a translation unit.
+ */
+static void end_executing_cmds(void)
+{
+    /* finished parsing and executing commands */
+    fflush(stdout);
+    fflush(stderr);
+    
+    /* discard the backup streams */
+    int i;
+    for(i = 0; i < 3; i++)
+    {
+        if(backup_fd[i] >= 0)
+        {
+            close(backup_fd[i]);
+            backup_fd[i] = -1;
+        }
+    }
+
+    /* reset the received signal flag */
+    signal_received = 0;
+
+    /* restore the terminal's non-canonical mode if needed */
+    if(read_stdin && interactive_shell)
+    {
+        term_canon(0);
+        update_row_col();
+    }
+}
+
+
+/*
+ * Execute the nodetrees we've loaded from the AST cache (or the source cache) for
+ * the translation unit in the passed source_s struct. This is the same as the loop
+ * in parse_and_execute(), except we get each command from the cache instead of the
+ * parser. The -v and savehist options need the text of each command, so we don't
+ * use the cache when they are set (see load_ast_cache()).
+ * 
+ * Returns 1 if all the commands were executed, 0 otherwise.
+ */
+int execute_ast_cache(struct source_s *src, struct ast_cache_s *cache)
+{
+    int res = 1;
+    long curline = 0;
+    struct node_s *cmd;
+
+    /* sanitize our indices for the next round */
+    req_continue   = 0;
+    req_break      = 0;
+    cur_loop_level = 0;
+
+    /* the arena we allocate each command's nodes from */
+    struct node_arena_s arena, *old_arena;
+    init_node_arena(&arena);
+
+    begin_executing_cmds();
+
+    while(1)
+    {
+        reset_node_arena(&arena);
+        old_arena = cur_node_arena;
+        cur_node_arena = &arena;
+        cmd = next_cached_cmd(cache, &curline);
+        cur_node_arena = old_arena;
+        if(!cmd)
+        {
+            break;
+        }
+        src->curline = curline;
+        dump_node_tree(cmd, 0);
+
+        /* dump the AST if the -d option is set (see parse_and_execute()) */
+        if(option_set('d'))
+        {
+            dump_node_tree(cmd, 1);
+        }
+
+        /* read commands but don't execute them (see parse_and_execute()) */
+        if(option_set('n') && !interactive_shell)
+        {
+            free_cached_cmd(cache, cmd);
+            continue;
+        }
+
+        /* now execute the command */
+        if(!do_list(src, cmd, NULL) && interactive_shell)
+        {
+            res = 0;
+            free_cached_cmd(cache, cmd);
+            break;
+        }
+
+        /* free the nodetree */
+        free_cached_cmd(cache, cmd);
+        fflush(stdout);
+        fflush(stderr);
+
+        /* we've got a return statement */
+        if(return_set)
+        {
+            return_set = 0;
+            res = 0;
+            break;
+        }
+
+        /* the -t option (see parse_and_execute()) */
+        if(option_set('t'))
+        {
+            exit_gracefully(exit_status, NULL);
+        }
+    }
+
+    free_node_arena(&arena);
+    end_executing_cmds();
+    return res;
+}
+
+
 /*
  * Parse and execute the translation unit we have in the passed source_s struct.
  * 
@@ -378,6 +671,15 @@ void do_history_and_print(struct source_s *src, struct node_s *cmd_tree)
  */
 int parse_and_execute(struct source_s *src)
 {
+    /* if we've cached the translation unit's nodetrees, execute them directly */
+    struct ast_cache_s cache;
+    if(load_ast_cache(src, &cache))
+    {
+        int res = execute_ast_cache(src, &cache);
+        close_ast_cache(&cache);
+        return res;
+    }
+
     /* prologue */
     struct token_s *old_current_token = dup_token(get_current_token());
     struct token_s *old_previous_token = dup_token(get_previous_token());
@@ -402,8 +704,12 @@ int parse_and_execute(struct source_s *src)
     char *p;
     struct token_s *tok = tokenize(src);
 
-    /* skip any leading comments/newlines */
-    while(tok->type != TOKEN_EOF)
+    /* the arena we allocate each command's nodes from */
+    struct node_arena_s arena, *old_arena;
+    init_node_arena(&arena);
+
+    /* skip any leading comments/newlines (parse_streamed_list() does this for streams) */
+    while(tok->type != TOKEN_EOF && src->buftype != SOURCE_BUF_STREAM)
     {
         /* skip comments and newlines */
         if(tok->type == TOKEN_COMMENT || tok->type == TOKEN_NEWLINE)
@@ -440,27 +746,38 @@ int parse_and_execute(struct source_s *src)
     /* clear the parser's error flag */
     parser_err = 0;
 
-    /* restore the terminal's canonical mode if needed */
-    if(read_stdin && interactive_shell)
-    {
-        term_canon(1);
-    }
-    
-    /*
-     * backup our standard streams so that we can restore them in case we needed
-     * to execute an EXIT trap any time while we are executing commands.
-     */
-    save_std(0, backup_fd);
-    save_std(1, backup_fd);
-    save_std(2, backup_fd);
+    begin_executing_cmds();
+
+    /* save the commands we parse to the AST cache, if it's enabled */
+    struct ast_cache_writer_s writer, *old_writer;
+    int caching = begin_ast_cache(src, &writer);
 
     /* loop parsing and executing commands */
     while(tok->type != TOKEN_EOF)
     {
         i = (src->curpos < 0) ? 0 : src->curpos;
 
-        /* parse the next command */
-        struct node_s *cmd = parse_list(tok);
+        /*
+         * parse the next command. the previous command's nodetree has been freed,
+         * so we can reuse the arena's memory.
+         */
+        struct node_s *cmd;
+        reset_node_arena(&arena);
+        old_arena = cur_node_arena;
+        cur_node_arena = &arena;
+        old_writer = cur_ast_cache_writer;
+        cur_ast_cache_writer = caching ? &writer : NULL;
+        if(src->buftype == SOURCE_BUF_STREAM)
+        {
+            cmd = parse_streamed_list(src);
+            i = (src->wstart < 0) ? 0 : src->wstart;
+        }
+        else
+        {
+            cmd = parse_list(tok);
+        }
+        cur_node_arena = old_arena;
+        cur_ast_cache_writer = old_writer;
         struct node_s *cmd2 = cmd;
         dump_node_tree(cmd, 0);
 
@@ -486,6 +803,11 @@ int parse_and_execute(struct source_s *src)
             cmd->lineno = src->curline;
         }
 
+        if(caching)
+        {
+            add_ast_cache_cmd(&writer, cmd, src->curline);
+        }
+
 #if 0
         /*
          * Determine if we're going to save commands to the history list.
@@ -637,7 +959,7 @@ int parse_and_execute(struct source_s *src)
          * Prepare for parsing the next command.
          * Skip optional newline and comment tokens.
          */
-        while(tok->type != TOKEN_EOF)
+        while(tok->type != TOKEN_EOF && src->buftype != SOURCE_BUF_STREAM)
         {
             if(tok->type == TOKEN_COMMENT || tok->type == TOKEN_NEWLINE)
             {
@@ -653,33 +975,18 @@ int parse_and_execute(struct source_s *src)
         src->wstart = src->curpos-(tok->text_len);
     }
 
+    /* we've parsed the whole file if we didn't bail out of the loop */
+    if(caching)
+    {
+        end_ast_cache(&writer, res);
+    }
+
     /* don't leave any hanging token structs */
     free_token(get_current_token());
     free_token(get_previous_token());
+    free_node_arena(&arena);
 
-    /* finished parsing and executing commands */
-    fflush(stdout);
-    fflush(stderr);
-    
-    /* discard the backup streams */
-    for(i = 0; i < 3; i++)
-    {
-        if(backup_fd[i] >= 0)
-        {
-            close(backup_fd[i]);
-            backup_fd[i] = -1;
-        }
-    }
-
-    /* reset the received signal flag */
-    signal_received = 0;
-
-    /* restore the terminal's non-canonical mode if needed */
-    if(read_stdin && interactive_shell)
-    {
-        term_canon(0);
-        update_row_col();
-    }
+    end_executing_cmds();
 
     /* epilogue */
     set_current_token(old_current_token);
@@ -689,13 +996,22 @@ int parse_and_execute(struct source_s *src)
 }
 
 
+/* files of this size or bigger are memory-mapped by read_file() */
+#define SCRIPT_MMAP_MIN_SIZE    (64*1024)
+
+/* number of bytes read_file() checks for null chars to detect binary files */
+#define BINARY_CHECK_SIZE       4096
+
+/* initial size of the buffer read_pipe() reads input into */
+#define PIPE_BUF_SIZE           4096
+
+
 /*
  * Read a file (presumably a script file) and initialize the
  * source_s struct so that we can parse and execute the file.
  * 
- * NOTE: This function doesn't handle big files. We should extend
- *       it so it uses memmaped files or any other method for handling
- *       big files.
+ * Big files are memory-mapped instead of being copied to a malloc'd buffer
+ * (see the buftype field of struct source_s).
  * 
  * Returns 1 if the file is loaded successfully, 0 otherwise.
  */
@@ -773,6 +1089,39 @@ int read_file(char *filename, struct source_s *src)
     }
     
 read:
+    src->buftype = SOURCE_BUF_OWNED;
+    
+    /*
+     * map big regular files into memory. we map the file privately and writable,
+     * as the parser removes heredocs from the input buffer in place. we can't
+     * map files whose size is a multiple of the page size, as the buffer must
+     * be null-terminated (the rest of the last page is zero-filled otherwise).
+     */
+    struct stat st;
+    if(fstat(fileno(f), &st) != 0)
+    {
+        memset(&st, 0, sizeof(st));
+    }
+    /* the AST cache uses the file's status to check if the file has changed */
+    src->filestat = st;
+    
+    if(S_ISREG(st.st_mode) &&
+       st.st_size >= SCRIPT_MMAP_MIN_SIZE && st.st_size % sysconf(_SC_PAGESIZE))
+    {
+        tmpbuf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      fileno(f), 0);
+        if(tmpbuf != MAP_FAILED)
+        {
+            i = st.st_size;
+            src->buftype = SOURCE_BUF_MAPPED;
+            src->mapsize = i;
+            fclose(f);
+            f = NULL;
+            goto check;
+        }
+        tmpbuf = NULL;
+    }
+
     /* seek to the end of the file */
     if(fseek(f, 0, SEEK_END) != 0)
     {
@@ -817,13 +1166,16 @@ read:
     }
 
     fclose(f);
+    f = NULL;
     
+check:
     /*
      * Make sure we've got a valid text file. bash seems to check files for
      * NULL characters, and if it finds more than 256, it regards the file
-     * as a binary file.
+     * as a binary file. we only check the beginning of the file, so that we
+     * don't touch every page of a big (mapped) file before we need to.
      */
-    char *p = tmpbuf, *p2 = p+i;
+    char *p = tmpbuf, *p2 = p+(i < BINARY_CHECK_SIZE ? i : BINARY_CHECK_SIZE);
     int nulls = 0;
     while(p < p2)
     {
@@ -833,7 +1185,8 @@ read:
             {
                 PRINT_ERROR("%s: cannot read `%s`: binary file\n", 
                             SOURCE_NAME, filename);
-                free(tmpbuf);
+                src->buffer = tmpbuf;
+                free_source_buffer(src);
                 free(filename2);
                 errno = ENOEXEC;
                 return 0;
@@ -869,13 +1222,16 @@ error:
 /*
  * Similar to read_file(), except it reads from a pipe.
  * 
+ * We read the input in blocks, doubling the buffer's size whenever it fills up.
+ *
  * Returns the count of bytes read, and stores the read string in str.
  */
 long read_pipe(FILE *f, char **str)
 {
-    int buf_size = 32;
-    char *buf = alloc_string_buf(buf_size);
-    long i = 0;
+    size_t buf_size = PIPE_BUF_SIZE;
+    /* add 1 for the null terminating byte */
+    char *buf = malloc(buf_size+1);
+    size_t i = 0, n;
     
     if(!buf)
     {
@@ -884,26 +1240,26 @@ long read_pipe(FILE *f, char **str)
         return 0;
     }
 
-    char *b = buf;
-    char *buf_end = b+buf_size-1;
-
-    while(!feof(f))
+    while((n = fread(buf+i, 1, buf_size-i, f)) > 0)
     {
-        if(fread(b, 1, 1, f) != 1)
-        {
-            continue;
-        }
-        
-        if(!may_extend_string_buf(&buf, &buf_end, &b, &buf_size))
+        i += n;
+
+        /* if buffer is full, extend it */
+        if(i == buf_size)
         {
-            PRINT_ERROR("%s: failed to allocate buffer: %s\n", SOURCE_NAME,
-                        strerror(errno));
-            return 0;
+            char *buf2 = realloc(buf, (buf_size*2)+1);
+            if(!buf2)
+            {
+                PRINT_ERROR("%s: failed to allocate buffer: %s\n", SOURCE_NAME,
+                            strerror(errno));
+                free(buf);
+                return 0;
+            }
+            buf = buf2;
+            buf_size *= 2;
         }
-        
-        b++;
-        i++;
     }
+    buf[i] = '\0';
     
     (*str) = buf;
     return i;
@@ -29,15 +29,50 @@
 #include "../debug.h"
 
 
+/* the arena new_node() allocates nodes from (NULL if we should malloc them) */
+struct node_arena_s *cur_node_arena = NULL;
+
+/* parse tree statistics (see node.h) */
+long node_count = 0;
+long node_arena_blocks = 0;
+
+
+/*
+ * Get a node struct from the given arena, adding a new block to the arena if
+ * the current block is full.
+ *
+ * Returns the node struct, or NULL on error.
+ */
+static struct node_s *arena_alloc_node(struct node_arena_s *arena)
+{
+    struct node_arena_block_s *block = arena->blocks;
+    if(!block || block->used == NODE_ARENA_BLOCK_NODES)
+    {
+        block = malloc(sizeof(struct node_arena_block_s));
+        if(!block)
+        {
+            return NULL;
+        }
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        node_arena_blocks++;
+    }
+    return &block->nodes[block->used++];
+}
+
+
 /*
- * Create a new node and assign it the given type.
+ * Create a new node and assign it the given type. If cur_node_arena is set,
+ * the node is alloc'd from the arena, otherwise it is malloc'd.
  * 
  * Returns the new node's struct, or NULL on error (we can also take the extreme
  * approach and exit the shell if there's not enough memory for the node struct).
  */
 struct node_s *new_node(enum node_type_e type)
 {
-    struct node_s *node = malloc(sizeof(struct node_s));
+    struct node_s *node = cur_node_arena ? arena_alloc_node(cur_node_arena) :
+                                           malloc(sizeof(struct node_s));
     if(!node)
     {
         //exit_gracefully(EXIT_FAILURE, "fatal error: Not enough memory for parser node struct");
@@ -47,6 +82,11 @@ struct node_s *new_node(enum node_type_e type)
     memset(node, 0, sizeof(struct node_s));
     /* set the node type */
     node->type = type;
+    node_count++;
+    if(cur_node_arena)
+    {
+        node->flags = NODE_FLAG_ARENA;
+    }
     /* return the node struct */
     return node;
 }
@@ -75,7 +115,6 @@ void add_child_node(struct node_s *parent, struct node_s *child)
         /* parent has no children. add at the end of the list */
         struct node_s *sibling = last_child(parent);
         sibling->next_sibling = child;
-        child->prev_sibling = sibling;
     }
     /* increment parent's child count */
     parent->children++;
@@ -110,6 +149,32 @@ struct node_s *last_child(struct node_s *parent)
 }
 
 
+/*
+ * Get the child that comes before the given child in the parent's children list.
+ * 
+ * Returns the previous child node, or NULL if child is the first child (or if
+ * it is not one of the parent's children).
+ */
+struct node_s *prev_child(struct node_s *parent, struct node_s *child)
+{
+    /* sanity check */
+    if(!parent || !child)
+    {
+        return NULL;
+    }
+    struct node_s *prev = parent->first_child;
+    if(prev == child)
+    {
+        return NULL;
+    }
+    while(prev && prev->next_sibling != child)
+    {
+        prev = prev->next_sibling;
+    }
+    return prev;
+}
+
+
 /*
  * Set the node's value to the given integer value.
  */
@@ -170,16 +235,6 @@ void set_node_val_sdouble(struct node_s *node, double val)
 }
 
 
-/*
- * Set the node's value to the given long double value.
- */
-void set_node_val_ldouble(struct node_s *node, long double val)
-{
-    node->val_type = VAL_LDOUBLE;
-    node->val.ldouble = val;
-}
-
-
 /*
  * Set the node's value to the given char value.
  */
@@ -259,7 +314,6 @@ char *get_node_val_type_str(enum val_type_e type)
         case VAL_SLLONG : return "VAL_SLLONG" ;
         case VAL_ULLONG : return "VAL_ULLONG" ;
         case VAL_FLOAT  : return "VAL_FLOAT"  ;
-        case VAL_LDOUBLE: return "VAL_LDOUBLE";
         case VAL_CHR    : return "VAL_CHR"    ;
         case VAL_STR    : return "VAL_STR"    ;
     }
@@ -303,10 +357,6 @@ void dump_node_tree(struct node_s *root, int level)
             fprintf(stderr, "%f"  , root->val.sfloat );
             break;
             
-        case VAL_LDOUBLE:
-            fprintf(stderr, "%Lg" , root->val.ldouble);
-            break;
-            
         case VAL_CHR    :
             fprintf(stderr, "%c"  , root->val.chr    );
             break;
@@ -354,8 +404,159 @@ void free_node_tree(struct node_s *node)
             free_malloced_str(node->val.str);
         }
     }
-    /* free the node iteself */
-    free(node);
+    /* free the cached command resolution, if any */
+    if(node->cmd_cache)
+    {
+        if(node->cmd_cache->name)
+        {
+            free_malloced_str(node->cmd_cache->name);
+        }
+        free(node->cmd_cache);
+    }
+    /*
+     * free the node iteself. arena nodes are released when the arena is reset,
+     * and the nodes of a packed nodetree are released with the tree's root.
+     */
+    if(!(node->flags & (NODE_FLAG_ARENA|NODE_FLAG_PACKED)) ||
+        (node->flags & NODE_FLAG_PACKED_ROOT))
+    {
+        free(node);
+    }
+}
+
+
+/*
+ * Count the nodes in the given nodetree.
+ */
+static long count_nodes(struct node_s *node)
+{
+    long count = 1;
+    struct node_s *child = node->first_child;
+    while(child)
+    {
+        count += count_nodes(child);
+        child = child->next_sibling;
+    }
+    return count;
+}
+
+
+/*
+ * Copy the given nodetree to the array of nodes pointed to by *next, in depth-
+ * first order, and advance *next past the copied nodes.
+ *
+ * Returns the copy of the root node.
+ */
+static struct node_s *copy_node_tree(struct node_s *node, struct node_s **next)
+{
+    struct node_s *copy = (*next)++;
+    memset(copy, 0, sizeof(struct node_s));
+    copy->type     = node->type;
+    copy->val_type = node->val_type;
+    copy->val      = node->val;
+    copy->children = node->children;
+    copy->lineno   = node->lineno;
+    copy->flags    = NODE_FLAG_PACKED;
+    if(node->val_type == VAL_STR && node->val.str)
+    {
+        copy->val.str = get_malloced_str(node->val.str);
+    }
+
+    struct node_s *child = node->first_child, *prev = NULL;
+    while(child)
+    {
+        struct node_s *child_copy = copy_node_tree(child, next);
+        if(prev)
+        {
+            prev->next_sibling = child_copy;
+        }
+        else
+        {
+            copy->first_child = child_copy;
+        }
+        prev = child_copy;
+        child = child->next_sibling;
+    }
+    return copy;
+}
+
+
+/*
+ * Copy the given nodetree (without the root's siblings) to a single block of
+ * memory, so that the nodes are close together when we walk the tree. We use
+ * this for nodetrees we keep for a long time, such as function bodies. The
+ * original tree is left intact, and should be freed by the caller.
+ *
+ * Returns the root of the packed nodetree (which is freed by calling
+ * free_node_tree() as usual), or NULL on error.
+ */
+struct node_s *pack_node_tree(struct node_s *root)
+{
+    if(!root)
+    {
+        return NULL;
+    }
+
+    struct node_s *nodes = malloc(count_nodes(root) * sizeof(struct node_s));
+    if(!nodes)
+    {
+        return NULL;
+    }
+
+    struct node_s *next = nodes;
+    root = copy_node_tree(root, &next);
+    root->flags |= NODE_FLAG_PACKED_ROOT;
+    return root;
+}
+
+
+/*
+ * Initialize a node arena.
+ */
+void init_node_arena(struct node_arena_s *arena)
+{
+    arena->blocks = NULL;
+}
+
+
+/*
+ * Release all the nodes in the given arena in one go, keeping one block around
+ * for the next command we parse. Strings and other memory the nodes point to
+ * should have been freed by calling free_node_tree().
+ */
+void reset_node_arena(struct node_arena_s *arena)
+{
+    struct node_arena_block_s *block = arena->blocks;
+    if(!block)
+    {
+        return;
+    }
+
+    struct node_arena_block_s *next = block->next;
+    block->next = NULL;
+    block->used = 0;
+    while(next)
+    {
+        block = next;
+        next = block->next;
+        free(block);
+        node_arena_blocks--;
+    }
+}
+
+
+/*
+ * Free the memory used by the given node arena.
+ */
+void free_node_arena(struct node_arena_s *arena)
+{
+    reset_node_arena(arena);
+    if(arena->blocks)
+    {
+        free(arena->blocks);
+        arena->blocks = NULL;
+        node_arena_blocks--;
+    }
 }
 
 
@@ -588,7 +789,8 @@ int pipe_tree_to_str(struct node_s *node)
             return 0;
         }
 
-        child = child->prev_sibling;
+        /* pipe commands are stored in reverse order (see parse_pipeline()) */
+        child = prev_child(node, child);
         
         if(child)
         {
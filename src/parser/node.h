@@ -72,13 +72,13 @@ enum val_type_e
     VAL_SLLONG,         /* signed long long */
     VAL_ULLONG,         /* unsigned long long */
     VAL_FLOAT,          /* floating point */
-    VAL_LDOUBLE,        /* long double */
     VAL_CHR,            /* char */
     VAL_STR,            /* str (char pointer) */
 };
 
 /*
  * a union to hold the value of the val field of the node_s struct (see below).
+ * we don't store long doubles, as this would double the size of the union.
  */
 union symval_u
 {
@@ -87,28 +87,87 @@ union symval_u
     long long          sllong;
     unsigned long long ullong;
     double             sfloat;
-    long double        ldouble;
     char               chr;
     char              *str;
 };
 
 /*
- * the node structure, which the parser uses to build the AST.
+ * the result of resolving the command word of a simple command, which we cache
+ * in the command's node so that we don't have to resolve the same command word
+ * every time the node is executed (e.g. in a loop body). the cache is valid as
+ * long as the command word is the same, and cmd_cache_epoch hasn't changed (we
+ * bump the epoch when builtins are enabled/disabled, or functions are defined
+ * or unset).
+ */
+struct cmd_cache_s
+{
+    unsigned long     epoch;        /* value of cmd_cache_epoch when we resolved the command */
+    char             *name;         /* the command word */
+    struct builtin_s *builtin;      /* the enabled builtin utility, NULL if none */
+    int               function;     /* 1 if the command is a shell function */
+};
+
+/*
+ * the node structure, which the parser uses to build the AST. the fields are
+ * ordered so that the struct has no padding holes (48 bytes on 64-bit systems),
+ * with the fields the backend reads when walking the tree coming first.
  */
 struct node_s
 {
-    enum   node_type_e type;    /* type of this node */
-    enum   val_type_e val_type; /* type of this node's val field */
-    union  symval_u val;        /* value of this node */
-    int    children;            /* number of child nodes */
-    struct node_s *first_child; /* first child node */
-    struct node_s *next_sibling, *prev_sibling; /*
-                                                 * if this is a child node, keep
-                                                 * pointers to prev/next siblings
-                                                 */
-    int    lineno;              /* line number where the node's token was encountered */
+    enum   node_type_e type: 8;     /* type of this node */
+    enum   val_type_e val_type: 8;  /* type of this node's val field */
+    unsigned int flags: 8;          /* where the node's memory comes from (see below) */
+    int    children;                /* number of child nodes */
+    struct node_s *first_child;     /* first child node */
+    struct node_s *next_sibling;    /* if this is a child node, the next sibling */
+    union  symval_u val;            /* value of this node */
+    struct cmd_cache_s *cmd_cache;  /* resolved command word (NODE_COMMAND only) */
+    int    lineno;                  /* line number where the node's token was encountered */
 };
 
+/*
+ * flags for the flags field of the node_s struct.
+ */
+#define NODE_FLAG_ARENA         (1 << 0)    /* node is alloc'd from a node arena */
+#define NODE_FLAG_PACKED        (1 << 1)    /* node is part of a packed nodetree */
+#define NODE_FLAG_PACKED_ROOT   (1 << 2)    /* root node of a packed nodetree */
+
+/*
+ * number of nodes in each block of a node arena.
+ */
+#define NODE_ARENA_BLOCK_NODES  128
+
+/*
+ * a block of node structs in a node arena (see below).
+ */
+struct node_arena_block_s
+{
+    struct node_arena_block_s *next;    /* the next (older) block */
+    int    used;                        /* number of nodes we've handed out */
+    struct node_s nodes[NODE_ARENA_BLOCK_NODES];
+};
+
+/*
+ * a node arena, from which the parser allocates the nodes of a command's
+ * nodetree, so that we can release all the nodes in one go after we execute
+ * the command (see parse_and_execute() in main.c).
+ */
+struct node_arena_s
+{
+    struct node_arena_block_s *blocks;  /* the newest block comes first */
+};
+
+/*
+ * the arena new_node() allocates nodes from. if NULL, nodes are malloc'd.
+ */
+extern struct node_arena_s *cur_node_arena;
+
+/*
+ * parse tree statistics (shown by the memusage builtin).
+ */
+extern long node_count;             /* number of nodes created by new_node() */
+extern long node_arena_blocks;      /* number of node arena blocks in use */
+
 /*
  * functions to manipulate node structs.
  */
@@ -126,5 +185,10 @@ void    dump_node_tree(struct node_s *func_body, int level);
 void    free_node_tree(struct node_s *node);
 char   *cmd_nodetree_to_str(struct node_s *node, int is_root);
 struct  node_s *last_child(struct node_s *parent);
+struct  node_s *prev_child(struct node_s *parent, struct node_s *child);
+struct  node_s *pack_node_tree(struct node_s *root);
+void    init_node_arena(struct node_arena_s *arena);
+void    reset_node_arena(struct node_arena_s *arena);
+void    free_node_arena(struct node_arena_s *arena);
 
 #endif
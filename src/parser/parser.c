@@ -30,6 +30,7 @@
 #include "../builtins/setx.h"
 #include "node.h"
 #include "parser.h"
+#include "../astcache.h"
 
 /*********************************************/
 /* top-down, recursive descent syntax parser */
@@ -142,6 +143,7 @@ char *get_alias_recursive(char *orig_name)
     {
         /* get the aliased value (if none defined, returns the same word) */
         p = get_alias_val(name);
+        note_alias_lookup(name, p);
 
         /* undefined or null alias */
         if(p == name || p == NULL)
@@ -726,23 +728,16 @@ struct node_s *parse_pipeline(struct token_s *tok)
             }
 
             /* add commands to the pipe sequence in reverse order (last command first) */
-            struct node_s *child = pipe->first_child;
-            node->next_sibling   = child;
-            if(child)
-            {
-                child->prev_sibling  = node;
-            }
-            pipe->first_child = node;
+            node->next_sibling = pipe->first_child;
+            pipe->first_child  = node;
         }
         else
         {
             /* end of the pipe sequence. return the parsed nodetree */
             if(pipe)
             {
-                struct node_s *child = pipe->first_child;
-                node->next_sibling   = child;
-                child->prev_sibling  = node;
-                pipe->first_child    = node;
+                node->next_sibling = pipe->first_child;
+                pipe->first_child  = node;
             }
             else
             {
@@ -1124,18 +1119,28 @@ static inline int is_compound_keyword_str(char *str)
         return 0;
     }
     
-    /* POSIX-defined compound words */
-    if(strcmp(str, "for") == 0 || strcmp(str, "case") == 0 ||
-       strcmp(str, "if") == 0 || strcmp(str, "while") == 0 ||
-       strcmp(str, "until") == 0 || str[0] == '{' || str[0] == '(')
+    if(str[0] == '{' || str[0] == '(')
     {
         return 1;
     }
-
-    /* non-POSIX compound word (only identified if POSIX mode is off) */
-    if(strcmp(str, "select") == 0 && !option_set('P'))
-    {
-        return 1;
+    
+    /* look the word up once, then classify it the same way is_compound_keyword() does */
+    switch(get_keyword_toktype(is_keyword(str)))
+    {
+        /* POSIX-defined compound words */
+        case TOKEN_KEYWORD_FOR  :
+        case TOKEN_KEYWORD_CASE :
+        case TOKEN_KEYWORD_IF   :
+        case TOKEN_KEYWORD_WHILE:
+        case TOKEN_KEYWORD_UNTIL:
+            return 1;
+            
+        /* non-POSIX compound word (only identified if POSIX mode is off) */
+        case TOKEN_KEYWORD_SELECT:
+            return !option_set('P');
+            
+        default:
+            break;
     }
     
     /* token is not a compound word */
@@ -1527,6 +1532,9 @@ int read_complete_line(struct source_s *src, char **cmd /* , char **heredocs */)
         buf[len+len2] = '\0';
         (*cmd) = buf;
         
+        /* in case we need to parse a streamed source's command again */
+        save_source_text(src);
+
         /* remove the heredocs from the original input stream */
         while((*nl++ = *p2++))
         {
@@ -1643,6 +1651,7 @@ struct node_s *parse_simple_command(struct token_s *tok)
     src2.buffer = cmd_line;
     src2.bufsize = len;
     src2.srctype = SOURCE_EXTERNAL_FILE;
+    src2.buftype = SOURCE_BUF_BORROWED;
     src2.curpos = INIT_SRC_POS;
 
     tok = tokenize(&src2);
@@ -1685,7 +1694,6 @@ loop:
                         {
                             set_node_val_str(redirect, s);
                             redirect->next_sibling = last->next_sibling;
-                            redirect->prev_sibling = last->prev_sibling;
                             
                             if(cmd->first_child == last)
                             {
@@ -1693,7 +1701,7 @@ loop:
                             }
                             else
                             {
-                                redirect->prev_sibling->next_sibling = redirect;
+                                prev_child(cmd, last)->next_sibling = redirect;
                             }
 
                             free_node_tree(last);
@@ -2162,6 +2170,10 @@ struct node_s *parse_command(struct token_s *tok)
     free_token(tok);
     set_current_token(get_previous_token());
     set_previous_token(NULL);
+    /* keep any input a streamed source has read in the meantime */
+    src2.bufsize = tok2->src->bufsize;
+    src2.eof     = tok2->src->eof;
+    src2.filled  = tok2->src->filled;
     memcpy(tok2->src, &src2, sizeof(struct source_s));
     
     /* we have a simple command */
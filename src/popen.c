@@ -185,6 +185,7 @@ FILE *popenr(char *cmd)
         src.buffer   = cmd;
         src.bufsize  = strlen(src.buffer);
         src.srctype  = SOURCE_CMDSTR;
+        src.buftype  = SOURCE_BUF_BORROWED;
         src.srcname  = NULL;
         src.curpos   = INIT_SRC_POS;
 
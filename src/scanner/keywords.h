@@ -22,7 +22,10 @@
 #ifndef KEYWORDS_H
 #define KEYWORDS_H
 
-/* the shell command language keywords */
+/*
+ * the shell command language keywords (the order of this array is relied upon
+ * by keyword_index() and get_keyword_toktype() in lexical.c).
+ */
 char *keywords[] =
 {
     /* POSIX keywords */
@@ -48,8 +51,6 @@ char *keywords[] =
     "time"    ,
     "coproc"  ,
 };
-/* keyword count */
-static int keyword_count = sizeof(keywords)/sizeof(char *);
 
 /* shell command language operators */
 char *operators[] =
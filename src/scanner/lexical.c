@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
@@ -40,6 +41,16 @@ static struct token_s *cur_tok  = NULL;
 /* a pointer to the previous token struct */
 static struct token_s *prev_tok = NULL;
 
+/*
+ * token structs we've freed, which we reuse instead of malloc'ing new ones, as
+ * we create and free a token for every word we read.
+ */
+static struct token_s *free_tokens = NULL;
+static int free_token_count = 0;
+
+/* the max number of free token structs we keep around */
+#define MAX_FREE_TOKENS         32
+
 /* special token to indicate end of input */
 struct token_s eof_token = 
 {
@@ -164,11 +175,94 @@ char *get_token_description(enum token_type_e type)
 }
 
 
+/*
+ * Return the index of the first len chars of str in the keywords array
+ * (defined in keywords.h), or -1 if they don't spell a keyword. Instead of
+ * comparing the word against every keyword in turn, we use the word's length
+ * and its first (and, where needed, second or third) char to pick the only
+ * keyword it can possibly be, then do a single compare to confirm the match.
+ * 
+ * NOTE: the indices below must match the order of the keywords array.
+ */
+static inline int keyword_index(char *str, size_t len)
+{
+    int i = -1;
+    switch(len)
+    {
+        case 1:
+            switch(str[0])
+            {
+                case '{': return 12;
+                case '}': return 13;
+                case '!': return 14;
+            }
+            return -1;
+            
+        case 2:
+            switch(str[0])
+            {
+                case 'i': i = (str[1] == 'f') ? 0 : 15; break;  /* if, in */
+                case 'f': i = 4 ; break;                        /* fi */
+                case 'd': i = 5 ; break;                        /* do */
+            }
+            break;
+            
+        case 3:
+            if(str[0] == 'f')
+            {
+                i = 11;                                         /* for */
+            }
+            break;
+            
+        case 4:
+            switch(str[0])
+            {
+                case 't': i = (str[1] == 'h') ? 1 : 18; break;  /* then, time */
+                case 'd': i = 6 ; break;                        /* done */
+                case 'c': i = 7 ; break;                        /* case */
+                case 'e':                                       /* else, elif, esac */
+                    i = (str[1] == 's') ? 8 : (str[2] == 's') ? 2 : 3;
+                    break;
+            }
+            break;
+            
+        case 5:
+            switch(str[0])
+            {
+                case 'w': i = 9 ; break;                        /* while */
+                case 'u': i = 10; break;                        /* until */
+            }
+            break;
+            
+        case 6:
+            switch(str[0])
+            {
+                case 's': i = 16; break;                        /* select */
+                case 'c': i = 19; break;                        /* coproc */
+            }
+            break;
+            
+        case 8:
+            if(str[0] == 'f')
+            {
+                i = 17;                                         /* function */
+            }
+            break;
+    }
+    
+    /* confirm the candidate keyword */
+    if(i >= 0 && memcmp(keywords[i], str, len) == 0)
+    {
+        return i;
+    }
+    return -1;
+}
+
+
 /*
  * Check if the given str is a shell keyword.
  * 
- * Returns the index of str in the keywords array, which is 0 to
- * one less than keyword_count, or -1 if the str is not a keyword.
+ * Returns the index of str in the keywords array, or -1 if the str is not a keyword.
  */
 int is_keyword(char *str)
 {
@@ -177,17 +271,7 @@ int is_keyword(char *str)
     {
         return -1;
     }
-    int i;
-    for(i = 0; i < keyword_count; i++)
-    {
-        /* check the string in the keywords array */
-        if(strcmp(keywords[i], str) == 0)
-        {
-            return i;
-        }
-    }
-    /* string is not a keyowrd */
-    return -1;
+    return keyword_index(str, strlen(str));
 }
 
 
@@ -349,7 +433,7 @@ void set_token_type(struct token_s *tok)
 
                 /* check if its a two-letter keyword */
                 int index = -1;
-                if((index = is_keyword(tok->text)) >= 0)
+                if((index = keyword_index(tok->text, 2)) >= 0)
                 {
                      t = get_keyword_toktype(index);
                 }
@@ -393,7 +477,7 @@ void set_token_type(struct token_s *tok)
         {
             /* check if its a keyword */
             int index = -1;
-            if((index = is_keyword(tok->text)) >= 0)
+            if((index = keyword_index(tok->text, tok->text_len)) >= 0)
             {
                  t = get_keyword_toktype(index);
             }
@@ -456,24 +540,114 @@ void set_token_type(struct token_s *tok)
 
 
 /*
- * Create a new token for the given str.
- * 
- * Returns a pointer to the struct token_s of the new token.
+ * Get a token struct from the list of free token structs, or malloc a new one
+ * if the list is empty, and give it a copy of the given text. Short text is
+ * stored in the token struct itself. We don't add the text to the strings
+ * buffer, as most tokens are discarded as soon as the parser has looked at them
+ * (the parser adds the text it stores in the AST to the strings buffer).
+ *
+ * Returns the token, or NULL on error.
  */
-struct token_s *create_token(char *str)
+struct token_s *create_token(char *str, int len)
 {
-    struct token_s *tok = malloc(sizeof(struct token_s));
-    if(!tok)
+    struct token_s *tok = free_tokens;
+    if(tok)
+    {
+        free_tokens = tok->next_free;
+        free_token_count--;
+    }
+    else if(!(tok = malloc(sizeof(struct token_s))))
     {
         return NULL;
     }
-    memset(tok, 0, sizeof(struct token_s));
-    tok->text_len = strlen(str);
-    tok->text = get_malloced_str(str);
+    memset(tok, 0, offsetof(struct token_s, inline_text));
+
+    if(len < TOKEN_INLINE_TEXT_SIZE)
+    {
+        tok->text = tok->inline_text;
+    }
+    else if(!(tok->text = malloc(len+1)))
+    {
+        free(tok);
+        return NULL;
+    }
+    memcpy(tok->text, str, len);
+    tok->text[len] = '\0';
+    tok->text_len = len;
     return tok;
 }
 
 
+/*
+ * Table of chars that tokenize() adds to the token buffer without any special
+ * processing (i.e. the chars that go to the default case of the switch statement
+ * in tokenize()). We use it to copy runs of such chars in one go.
+ */
+static char word_chars[256];
+
+
+/*
+ * Initialize the word_chars table (see above).
+ */
+static void init_word_chars(void)
+{
+    char *special = " \t\n\"'`\\$<>|&;()#";
+    int c;
+    for(c = 1; c < 256; c++)
+    {
+        word_chars[c] = !strchr(special, c);
+    }
+    /* this is what next_char() returns on EOF */
+    word_chars[(unsigned char)EOF] = 0;
+}
+
+
+/*
+ * Copy the run of plain word chars that follows the current char in input
+ * to the token buffer, and advance the source pointers past the copied chars.
+ * The run doesn't contain any newlines, so only the char pointer changes.
+ */
+static void add_word_chars_to_buf(struct source_s *src)
+{
+    char *start = src->buffer+src->curpos+1, *p = start;
+    char *end = src->buffer+src->bufsize;
+    while(p < end && word_chars[(unsigned char)*p])
+    {
+        p++;
+    }
+
+    int count = p-start;
+    if(!count)
+    {
+        return;
+    }
+
+    /* make sure we have room for the chars and the terminating null byte */
+    if(tok_bufindex+count >= tok_bufsize)
+    {
+        int size = tok_bufsize;
+        while(tok_bufindex+count >= size)
+        {
+            size *= 2;
+        }
+
+        char *tmp = realloc(tok_buf, size);
+        if(!tmp)
+        {
+            /* let next_char() and add_to_buf() do the work */
+            return;
+        }
+        tok_buf = tmp;
+        tok_bufsize = size;
+    }
+
+    memcpy(tok_buf+tok_bufindex, start, count);
+    tok_bufindex  += count;
+    src->curpos   += count;
+    src->curchar  += count;
+}
+
+
 /*
  * Add a character to the token buffer. When NULL-terminated later on,
  * the buffer will contain the text of the current token.
@@ -546,23 +720,33 @@ struct token_s *dup_token(struct token_s *tok)
         return NULL;
     }
 
-    /* alloc memory for the token struct */
-    struct token_s *tok2 = malloc(sizeof(struct token_s));
-    if(!tok2)
+    /* alloc memory for the token struct and copy the text string */
+    struct token_s *tok2;
+    if(tok->text)
     {
-        return NULL;
+        tok->text_len = strlen(tok->text);
+        tok2 = create_token(tok->text, tok->text_len);
+    }
+    else
+    {
+        tok2 = create_token("", 0);
+        if(tok2)
+        {
+            tok2->text = NULL;
+        }
     }
 
-    /* copy the old token into the new one */
-    memcpy(tok2, tok, sizeof(struct token_s));
-    
-    /* copy the text string */
-    if(tok->text)
+    if(!tok2)
     {
-        tok->text_len = strlen(tok->text);
-        tok2->text = get_malloced_str(tok->text);
+        return NULL;
     }
-    tok2->text_len = tok->text_len;
+
+    /* copy the rest of the old token into the new one */
+    tok2->type      = tok->type;
+    tok2->lineno    = tok->lineno;
+    tok2->charno    = tok->charno;
+    tok2->linestart = tok->linestart;
+    tok2->src       = tok->src;
     
     /* return the new token */
     return tok2;
@@ -581,13 +765,22 @@ void free_token(struct token_s *tok)
     }
 
     /* free the token text */
-    if(tok->text)
+    if(tok->text && tok->text != tok->inline_text)
     {
-        free_malloced_str(tok->text);
+        free(tok->text);
     }
     
-    /* free the token struct */
-    free(tok);
+    /* free the token struct, or keep it for reuse */
+    if(free_token_count < MAX_FREE_TOKENS)
+    {
+        tok->next_free = free_tokens;
+        free_tokens = tok;
+        free_token_count++;
+    }
+    else
+    {
+        free(tok);
+    }
 
     /* update the current token struct pointer */
     if(cur_tok == tok)
@@ -668,7 +861,7 @@ int is_token_of_type(struct token_s *tok, enum token_type_e type)
  */
 struct token_s *tokenize(struct source_s *src)
 {
-    if(!src || !src->buffer || !src->bufsize)
+    if(!src || !src->buffer || (!src->bufsize && !fill_source_buffer(src)))
     {
         errno = ENODATA;
         return &eof_token;
@@ -685,6 +878,7 @@ struct token_s *tokenize(struct source_s *src)
             eof_token.src = src;
             return &eof_token;
         }
+        init_word_chars();
     }
     
     /* empty the buffer */
@@ -1042,6 +1236,8 @@ struct token_s *tokenize(struct source_s *src)
             default:
                 /* for all other chars, just add to the buffer */
                 add_to_buf(nc);
+                /* and add the plain chars that follow in one go */
+                add_word_chars_to_buf(src);
                 break;
         }
         
@@ -1068,7 +1264,7 @@ struct token_s *tokenize(struct source_s *src)
     tok_buf[tok_bufindex] = '\0';
 
     /* create the token */
-    tok = create_token(tok_buf);
+    tok = create_token(tok_buf, tok_bufindex);
     if(!tok)
     {
         PRINT_ERROR("%s: failed to alloc buffer: %s\n", 
@@ -97,6 +97,9 @@ enum token_type_e
         TOKEN_KEYWORD_NA
 };
 
+/* size of the buffer that holds short token text in the token struct itself */
+#define TOKEN_INLINE_TEXT_SIZE      32
+
 /* the token struct that is returned by the lexical scanner */
 struct token_s
 {
@@ -105,7 +108,9 @@ struct token_s
         long   linestart;           /* start of line where token is found (for error msgs) */
         struct source_s *src;       /* source of input */
         int    text_len;            /* length of token text */
-        char   *text;               /* token text */
+        char   *text;               /* token text (points to inline_text if the text is short) */
+        struct token_s *next_free;  /* next struct in the list of free token structs */
+        char   inline_text[TOKEN_INLINE_TEXT_SIZE];
 };
 
 /* the special EOF token, which indicates the end of input */
@@ -123,6 +128,7 @@ void   set_previous_token(struct token_s *tok);
 void   free_token(struct token_s *tok);
 int    is_token_of_type(struct token_s *tok, enum token_type_e type);
 int    is_keyword(char *str);
+enum   token_type_e get_keyword_toktype(int index);
 int    is_separator_tok(enum token_type_e type);
 
 #endif
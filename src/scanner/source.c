@@ -20,6 +20,10 @@
  */    
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "../cmd.h"
 #include "source.h"
 
@@ -115,8 +119,9 @@ char next_char(struct source_s *src)
         src->curlinestart =  0;
     }
 
-    /* did we reach EOF? */
-    if(++src->curpos >= src->bufsize)
+    /* did we reach EOF? if we are reading input in chunks, try to read some more */
+    if(++src->curpos >= src->bufsize &&
+       (src->curpos > src->bufsize || !fill_source_buffer(src)))
     {
         src->curpos = src->bufsize;
         return EOF;
@@ -168,8 +173,9 @@ char peek_char(struct source_s *src)
     }
     pos++;
     
-    /* reached EOF? */
-    if(pos >= src->bufsize)
+    /* reached EOF? if we are reading input in chunks, try to read some more */
+    if(pos >= src->bufsize &&
+       (pos > src->bufsize || !fill_source_buffer(src)))
     {
         return EOF;
     }
@@ -196,3 +202,222 @@ void skip_white_spaces(struct source_s *src)
         next_char(src);
     }
 }
+
+
+/*
+ * Release the input text of the given source, depending on how we obtained
+ * the text (see read_file() in main.c).
+ */
+void free_source_buffer(struct source_s *src)
+{
+    if(!src->buffer)
+    {
+        return;
+    }
+
+    switch(src->buftype)
+    {
+        case SOURCE_BUF_OWNED:
+            free(src->buffer);
+            break;
+
+        case SOURCE_BUF_MAPPED:
+            munmap(src->buffer, src->mapsize);
+            break;
+
+        case SOURCE_BUF_STREAM:
+            free(src->buffer);
+            if(src->savebuf)
+            {
+                free(src->savebuf);
+                src->savebuf = NULL;
+            }
+            break;
+    }
+    src->buffer = NULL;
+}
+
+
+/*
+ * Streamed sources.
+ *
+ * Instead of reading the whole input text before we start parsing, we can
+ * read it from a file descriptor in chunks (this is what we do when we read
+ * a script from a pipe). next_char() and peek_char() read the next chunk when
+ * they reach the end of the buffer, and parse_and_execute() discards the text
+ * of the commands we've already executed, so that we use a bounded amount of
+ * memory however long the script is.
+ *
+ * The parser scans the buffer directly in many places, so we never move the
+ * buffer while a command is being parsed: we only read as much text as fits
+ * in the memory we've already alloc'd. If we read more text while parsing a
+ * command, or if the command doesn't fit in the buffer, parse_and_execute()
+ * extends the buffer and parses the command again.
+ */
+
+/* number of bytes we read from the file in one go */
+#define SOURCE_STREAM_CHUNK     16384
+
+/* initial size of the buffer of a streamed source */
+#define SOURCE_STREAM_BUF_SIZE  (SOURCE_STREAM_CHUNK*4)
+
+
+/*
+ * Initialize src so that we read the input text from the given file descriptor.
+ * We read the first chunk, so that the parser has something to start with.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int init_source_stream(struct source_s *src, int fd)
+{
+    src->buffer = malloc(SOURCE_STREAM_BUF_SIZE);
+    if(!src->buffer)
+    {
+        return 0;
+    }
+    src->buffer[0] = '\0';
+    src->bufsize  = 0;
+    src->bufcap   = SOURCE_STREAM_BUF_SIZE;
+    src->buftype  = SOURCE_BUF_STREAM;
+    src->fd       = fd;
+    src->eof      = 0;
+    src->filled   = 0;
+    src->savepos  = 0;
+    src->savebuf  = NULL;
+    src->savesize = 0;
+    fill_source_buffer(src);
+    return 1;
+}
+
+
+/*
+ * Read the next chunk of a streamed source into the unused part of the buffer.
+ * We don't read anything after the parser cuts text out of the buffer (see
+ * save_source_text() below), as we won't be able to put it back in place.
+ *
+ * Returns the number of bytes read, 0 if we can't read anything (not a
+ * streamed source, end of file, or no room left in the buffer).
+ */
+long fill_source_buffer(struct source_s *src)
+{
+    if(src->buftype != SOURCE_BUF_STREAM || src->eof || src->savebuf)
+    {
+        return 0;
+    }
+
+    /* leave room for the terminating null byte */
+    long room = src->bufcap-src->bufsize-1;
+    if(room > SOURCE_STREAM_CHUNK)
+    {
+        room = SOURCE_STREAM_CHUNK;
+    }
+
+    if(room <= 0)
+    {
+        return 0;
+    }
+
+    ssize_t n;
+    while((n = read(src->fd, src->buffer+src->bufsize, room)) < 0 && errno == EINTR)
+    {
+        ;
+    }
+
+    /* treat read errors as end of file */
+    if(n <= 0)
+    {
+        src->eof = 1;
+        return 0;
+    }
+
+    src->bufsize += n;
+    src->buffer[src->bufsize] = '\0';
+    src->filled = 1;
+    return n;
+}
+
+
+/*
+ * Double the size of the buffer of a streamed source. As this might move the
+ * buffer, we should never call this function while a command is being parsed.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+int grow_source_buffer(struct source_s *src)
+{
+    char *buf = realloc(src->buffer, src->bufcap*2);
+    if(!buf)
+    {
+        return 0;
+    }
+    src->buffer  = buf;
+    src->bufcap *= 2;
+    return 1;
+}
+
+
+/*
+ * Discard the input text that comes before pos, which should be the start of a
+ * line (the text of the commands we've already parsed and executed), and adjust
+ * the source pointers accordingly. Here-documents and function bodies are copied
+ * to the parse tree, so we don't need to keep their text in the buffer.
+ *
+ * Returns the number of discarded chars.
+ */
+long discard_source_text(struct source_s *src, long pos)
+{
+    if(src->buftype != SOURCE_BUF_STREAM || pos <= 0 || pos > src->bufsize)
+    {
+        return 0;
+    }
+
+    memmove(src->buffer, src->buffer+pos, src->bufsize-pos+1);
+    src->bufsize      -= pos;
+    src->curpos       -= pos;
+    src->curlinestart -= pos;
+    src->curpos_old   -= pos;
+    src->wstart        = (src->wstart > pos) ? src->wstart-pos : 0;
+    return pos;
+}
+
+
+/*
+ * The parser removes here-documents from the input buffer in place. Before it
+ * does so, we save a copy of the text of the command we are parsing, so that we
+ * can restore it if we need to parse the command again (see the comment above).
+ */
+void save_source_text(struct source_s *src)
+{
+    if(src->buftype != SOURCE_BUF_STREAM || src->savebuf)
+    {
+        return;
+    }
+
+    long len = src->bufsize-src->savepos;
+    src->savebuf = malloc(len+1);
+    if(!src->savebuf)
+    {
+        return;
+    }
+    memcpy(src->savebuf, src->buffer+src->savepos, len+1);
+    src->savesize = len;
+}
+
+
+/*
+ * Restore the text saved by save_source_text() to the buffer, and release the
+ * saved copy. As we don't read any more text after saving (see fill_source_buffer()),
+ * the restored text fits in the buffer.
+ */
+void restore_source_text(struct source_s *src)
+{
+    if(!src->savebuf)
+    {
+        return;
+    }
+
+    memcpy(src->buffer+src->savepos, src->savebuf, src->savesize+1);
+    src->bufsize = src->savepos+src->savesize;
+    free(src->savebuf);
+    src->savebuf = NULL;
+}
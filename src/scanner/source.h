@@ -22,6 +22,8 @@
 #ifndef SOURCE_H
 #define SOURCE_H
 
+#include <sys/stat.h>
+
 #define EOF             (-1)
 #define ERRCHAR         ( 0)
 
@@ -52,6 +54,22 @@ struct source_s
          curlinestart;  /* absolute start of current line in source */
     long curpos_old;    /* OLD absolute char position (used when reading simple cmds) */
     long wstart;        /* start of currently parsed commandline */
+    /* values for the buftype field below */
+#define SOURCE_BUF_OWNED        0   /* malloc'd buffer, which we should free() */
+#define SOURCE_BUF_MAPPED       1   /* memory-mapped file, which we should munmap() */
+#define SOURCE_BUF_BORROWED     2   /* buffer owned by someone else */
+#define SOURCE_BUF_STREAM       3   /* malloc'd buffer, which we fill from fd in chunks */
+    int  buftype;       /* how we release the input text */
+    long mapsize;       /* size of the mapped region (if buftype is SOURCE_BUF_MAPPED) */
+    /* the following fields are only used if buftype is SOURCE_BUF_STREAM */
+    int  fd;            /* file descriptor we read the input text from */
+    int  eof;           /* set when we've read all the input text from fd */
+    int  filled;        /* set when we read more input text into the buffer */
+    long bufcap;        /* size of the memory alloc'd for the buffer */
+    long savepos;       /* start of the command we are currently parsing */
+    char *savebuf;      /* copy of the input text from savepos on (see save_source_text()) */
+    long savesize;      /* length of the saved copy */
+    struct stat filestat;   /* status of the file read_file() read the input text from */
 };
 
 /* functions to manipulate input sources */
@@ -60,5 +78,12 @@ char next_char(struct source_s *src);
 char prev_char(struct source_s *src);
 void unget_char(struct source_s *src);
 void skip_white_spaces(struct source_s *src);
+void free_source_buffer(struct source_s *src);
+int  init_source_stream(struct source_s *src, int fd);
+long fill_source_buffer(struct source_s *src);
+int  grow_source_buffer(struct source_s *src);
+long discard_source_text(struct source_s *src, long pos);
+void save_source_text(struct source_s *src);
+void restore_source_text(struct source_s *src);
 
 #endif
@@ -102,7 +102,9 @@ char *get_malloced_str(char *str)
     /* search the strings buffer for str */
     if(str_hashes)
     {
-        struct hashitem_s *entry = get_hash_item(str_hashes, str);
+        /* hash str once, for both the search and the insertion */
+        uint32_t hash = calc_hash(str);
+        struct hashitem_s *entry = get_hash_itemh(str_hashes, str, hash);
         if(entry)   /* entry found */
         {
             /* increment the count of references to str */
@@ -111,7 +113,7 @@ char *get_malloced_str(char *str)
         }
         else        /* entry not found. add a new entry */
         {
-            entry = add_hash_itemb(str_hashes, str, 1);
+            entry = add_hash_itemh(str_hashes, str, hash, 1);
             if(entry)
             {
                 return entry->name;
@@ -166,7 +168,8 @@ void free_malloced_str(char *str)
             entry->refs--;
             if(entry->refs <= 0)
             {
-                rem_hash_item(str_hashes, str);
+                /* remove the entry we've found, without searching for it again */
+                rem_hash_entry(str_hashes, entry);
             }
         }
         return;
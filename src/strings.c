@@ -546,11 +546,11 @@ char *alloc_string_buf(int size)
 int may_extend_string_buf(char **buf, char **buf_end, char **buf_ptr, int *buf_size)
 {
     /* if buffer is full, extend it */
-    if(buf_ptr == buf_end)
+    if((*buf_ptr) == (*buf_end))
     {
         (*buf_size) *= 2;
         
-        char *buf2 = realloc(buf, (*buf_size));
+        char *buf2 = realloc((*buf), (*buf_size));
         if(!buf2)
         {
             return 0;
@@ -71,18 +71,20 @@ uint32_t fnv1a(char *text, uint32_t hash)
 }
 
 /*
- * Calculate and return the hash index of the given string.
+ * Calculate and return the hash of the given string. The full hash is stored
+ * in the hash item, and the index of the item's bucket in the hash table is
+ * the hash modulo the table's size.
  * 
  * TODO: If you want to use another hashing algorithm, change the
  *       function call to fnv1a() to any other function.
  */
-uint32_t calc_hash(struct hashtab_s *table, char *text)
+uint32_t calc_hash(char *text)
 {
-    if(!table || !text)
+    if(!text)
     {
         return 0;
     }
-    return fnv1a(text, fnv1a_seed) % table->size;
+    return fnv1a(text, fnv1a_seed);
 }
 
 /*************************************************
@@ -105,6 +107,10 @@ struct hashtab_s *new_hashtable_sz(int size)
     }
     table->size   = size;               /* use the given size */
     table->used   = 0;                  /* empty bucket list */
+    table->min_size     = size;         /* don't shrink below the initial size */
+    table->old_size     = 0;            /* we are not resizing */
+    table->rehash_index = 0;
+    table->old_items    = NULL;
     size_t itemsz = size * sizeof(struct hashitem_s *);
     table->items  = malloc(itemsz);     /* alloc space for buckets */
     if(!table->items)
@@ -131,6 +137,124 @@ struct hashtab_s *new_hashtable(void)
 }
 
 
+/*
+ * Move the items of up to 'count' non-empty buckets from the old buckets array
+ * of a table that is being resized to the new buckets array. We also limit the
+ * number of empty buckets we visit, so that a sparse old array doesn't make a
+ * single add or remove operation take too long. When all the old buckets have
+ * been moved, the old buckets array is freed.
+ */
+static void hash_rehash_step(struct hashtab_s *table, int count)
+{
+    if(!table->old_items)
+    {
+        return;
+    }
+    int visits = count * 10;
+    while(count > 0 && visits-- > 0 && table->rehash_index < table->old_size)
+    {
+        struct hashitem_s *entry = table->old_items[table->rehash_index];
+        if(entry)
+        {
+            count--;
+        }
+        /* move the bucket's items to their new buckets */
+        while(entry)
+        {
+            struct hashitem_s *next = entry->next;
+            int index = entry->hash % table->size;
+            entry->next = table->items[index];
+            table->items[index] = entry;
+            entry = next;
+        }
+        table->old_items[table->rehash_index++] = NULL;
+    }
+    /* all old buckets moved. we're done resizing */
+    if(table->rehash_index >= table->old_size)
+    {
+        free(table->old_items);
+        table->old_items    = NULL;
+        table->old_size     = 0;
+        table->rehash_index = 0;
+    }
+}
+
+
+/*
+ * If the given table is being resized, move all the remaining buckets from
+ * the old buckets array to the new one. This should be called before iterating
+ * through the table's buckets array.
+ */
+void finish_hash_rehash(struct hashtab_s *table)
+{
+    if(table && table->old_items)
+    {
+        hash_rehash_step(table, table->old_size);
+    }
+}
+
+
+/*
+ * Resize a table to the given number of buckets. The items are not moved
+ * here, they are moved gradually by hash_rehash_step() on the following
+ * add and remove operations. If we fail to alloc memory for the new buckets
+ * array, we silently keep the current array.
+ */
+static void hash_resize(struct hashtab_s *table, int newsize)
+{
+    /* finish any resizing that is still in progress */
+    finish_hash_rehash(table);
+    size_t itemsz = newsize * sizeof(struct hashitem_s *);
+    struct hashitem_s **items = malloc(itemsz);
+    if(!items)
+    {
+        return;
+    }
+    memset(items, 0, itemsz);
+    table->old_items    = table->items;
+    table->old_size     = table->size;
+    table->rehash_index = 0;
+    table->items        = items;
+    table->size         = newsize;
+    hash_rehash_step(table, HASHTABLE_REHASH_STEP);
+}
+
+
+/*
+ * Called after adding an item to a table. Continue resizing the table,
+ * or grow it if it's getting crowded.
+ */
+static inline void hash_grow(struct hashtab_s *table)
+{
+    if(table->old_items)
+    {
+        hash_rehash_step(table, HASHTABLE_REHASH_STEP);
+    }
+    else if(table->used > table->size * HASHTABLE_MAX_LOAD)
+    {
+        hash_resize(table, table->size << 1);
+    }
+}
+
+
+/*
+ * Called after removing an item from a table. Continue resizing the table,
+ * or shrink it if it has emptied out.
+ */
+static inline void hash_shrink(struct hashtab_s *table)
+{
+    if(table->old_items)
+    {
+        hash_rehash_step(table, HASHTABLE_REHASH_STEP);
+    }
+    else if(table->size > table->min_size &&
+            table->used * HASHTABLE_MIN_LOAD < table->size)
+    {
+        hash_resize(table, table->size >> 1);
+    }
+}
+
+
 /*
  * Free the memory used by a hash table, as well as its contained strings.
  */
@@ -155,6 +279,8 @@ void rem_all_items(struct hashtab_s *table, int free_index)
     {
         return;
     }
+    /* get all items in one buckets array */
+    finish_hash_rehash(table);
     /* check if there are used buckets in the hash table */
     if(table->used)
     {
@@ -182,6 +308,8 @@ void rem_all_items(struct hashtab_s *table, int free_index)
                 free(entry);
                 entry = next;
             }
+            /* empty the bucket, in case we reuse the table */
+            *h1 = NULL;
         }
     }
     table->used = 0;
@@ -195,14 +323,12 @@ void rem_all_items(struct hashtab_s *table, int free_index)
 
 
 /*
- * Remove a string from a hash table, given pointers to the string and the
- * hash table.
+ * Unlink an item from the given bucket's linked list.
+ * Returns 1 if the item was found in the bucket, 0 otherwise.
  */
-void rem_hash_item(struct hashtab_s *table, char *key)
+static int rem_from_bucket(struct hashitem_s *entry, struct hashitem_s **bucket)
 {
-    /* calc the key hash and get the table's bucket */
-    int index = calc_hash(table, key);
-    struct hashitem_s *e = table->items[index];
+    struct hashitem_s *e = *bucket;
     struct hashitem_s *p = NULL;
     /*
      * As the bucket can contain more than one entry, our target entry can
@@ -211,38 +337,113 @@ void rem_hash_item(struct hashtab_s *table, char *key)
      */
     while(e)
     {
-        /* found the string */
-        if(is_same_str(e->name, key))
+        if(e == entry)
         {
             /*
-             * If this is the first item in the list, adjust the table
+             * If this is the first item in the list, adjust the bucket
              * pointer to point to the next item. Otherwise, ajust
              * the previous item's pointer to point to the next item.
              */
             if(!p)
             {
-                table->items[index] = e->next;
+                *bucket = e->next;
             }
             else
             {
                 p->next = e->next;
             }
-            /* free the memory used by this entry's value */
-            if(e->val)
-            {
-                free(e->val);
-            }
-            /* free the key string */
-            free(e->name);
-            /* and the entry itself */
-            free(e);
-            /* decrement the count of used entries in the table */
-            table->used--;
-            break;
+            return 1;
         }
         /* check the next entry */
         p = e, e = e->next;
     }
+    return 0;
+}
+
+
+/*
+ * Remove an item from a hash table, given pointers to the item and the hash
+ * table. We use the hash stored in the item to find its bucket, so we don't
+ * need to hash the key string again.
+ */
+void rem_hash_entry(struct hashtab_s *table, struct hashitem_s *entry)
+{
+    if(!table || !entry)
+    {
+        return;
+    }
+    /*
+     * If the table is being resized, the item might still be in the old
+     * buckets array. Check there first.
+     */
+    if(!table->old_items ||
+       !rem_from_bucket(entry, &table->old_items[entry->hash % table->old_size]))
+    {
+        if(!rem_from_bucket(entry, &table->items[entry->hash % table->size]))
+        {
+            return;
+        }
+    }
+    /* free the memory used by this entry's value */
+    if(entry->val)
+    {
+        free(entry->val);
+    }
+    /* free the key string */
+    free(entry->name);
+    /* and the entry itself */
+    free(entry);
+    /* decrement the count of used entries in the table */
+    table->used--;
+    /* continue resizing, or shrink the table */
+    hash_shrink(table);
+}
+
+
+/*
+ * Remove a string from a hash table, given pointers to the string and the
+ * hash table.
+ */
+void rem_hash_item(struct hashtab_s *table, char *key)
+{
+    rem_hash_entry(table, get_hash_item(table, key));
+}
+
+
+/*
+ * Add a new item to a hash table, given the key string and its hash. The caller
+ * must make sure the key is not already in the table. In case of insufficient
+ * memory, return NULL.
+ */
+static struct hashitem_s *new_hash_item(struct hashtab_s *table, char *key, uint32_t hash)
+{
+    /* add a new entry */
+    struct hashitem_s *entry = malloc(sizeof(struct hashitem_s));
+    if(!entry)
+    {
+        PRINT_ERROR("%s: failed to malloc hashtable item\n", SOURCE_NAME);
+        return NULL;
+    }
+    /* initialize it */
+    memset(entry, 0, sizeof(struct hashitem_s));
+    entry->name = __get_malloced_str(key);
+    entry->hash = hash;
+    /*
+     * We are acting on the premise that a newly added variable
+     * is bound to be accessed sooner than later, this is why we
+     * add the new variable to the start of the linked list for 
+     * that bucket. Think about it, when you declare a variable,
+     * you are probably going to use it soon, right? Or maybe wrong,
+     * but this is how we do it here :)
+     */
+    int index = hash % table->size;
+    entry->next = table->items[index];
+    table->items[index] = entry;
+    table->used++;
+    /* continue resizing, or grow the table */
+    hash_grow(table);
+    /* return the new entry */
+    return entry;
 }
 
 
@@ -260,9 +461,10 @@ struct hashitem_s *add_hash_item(struct hashtab_s *table, char *key, char *value
         return NULL;
     }
     /* do not duplicate an existing entry */
+    uint32_t hash = calc_hash(key);
     struct hashitem_s *entry = NULL;
     /* entry exists */
-    if((entry = get_hash_item(table, key)))
+    if((entry = get_hash_itemh(table, key, hash)))
     {
         /* don't alloc new string if the new value is the same as the old value. */
         if(entry->val && value && is_same_str(entry->val, value))
@@ -279,30 +481,12 @@ struct hashitem_s *add_hash_item(struct hashtab_s *table, char *key, char *value
         /* return the entry struct */
         return entry;
     }
-    /* add a new entry */
-    entry = malloc(sizeof(struct hashitem_s));
-    if(!entry)
+    /* add a new entry and save the key/value pair */
+    entry = new_hash_item(table, key, hash);
+    if(entry)
     {
-        PRINT_ERROR("%s: failed to malloc hashtable item\n", SOURCE_NAME);
-        return NULL;
+        entry->val = __get_malloced_str(value);
     }
-    /* initialize it */
-    memset(entry, 0, sizeof(struct hashitem_s));
-    /* save the key/value pair */
-    entry->name = __get_malloced_str(key  );
-    entry->val  = __get_malloced_str(value);
-    /*
-     * We are acting on the premise that a newly added variable
-     * is bound to be accessed sooner than later, this is why we
-     * add the new variable to the start of the linked list for 
-     * that bucket. Think about it, when you declare a variable,
-     * you are probably going to use it soon, right? Or maybe wrong,
-     * but this is how we do it here :)
-     */
-    int index = calc_hash(table, key);
-    entry->next = table->items[index];
-    table->items[index] = entry;
-    table->used++;
     /* return the new entry */
     return entry;
 }
@@ -316,6 +500,24 @@ struct hashitem_s *add_hash_item(struct hashtab_s *table, char *key, char *value
  *          buffer in strbuf.c and you know what you're doing.
  */
 struct hashitem_s *add_hash_itemb(struct hashtab_s *table, char *key, long value)
+{
+    if(!table || !key)
+    {
+        return NULL;
+    }
+    return add_hash_itemh(table, key, calc_hash(key), value);
+}
+
+
+/*
+ * Similar to add_hash_itemb(), except the caller passes the key's hash, which
+ * the caller got from a previous call to calc_hash(). This saves the string
+ * buffer from hashing the same string twice.
+ * 
+ * WARNING: DO NOT use this function at all, unless you are modifying the string
+ *          buffer in strbuf.c and you know what you're doing.
+ */
+struct hashitem_s *add_hash_itemh(struct hashtab_s *table, char *key, uint32_t hash, long value)
 {
     if(!table || !key)
     {
@@ -323,58 +525,34 @@ struct hashitem_s *add_hash_itemb(struct hashtab_s *table, char *key, long value
     }
     /* do not duplicate an existing entry */
     struct hashitem_s *entry = NULL;
-    if((entry = get_hash_item(table, key)))
+    if((entry = get_hash_itemh(table, key, hash)))
     {
         entry->refs = value;
         return entry;
     }
     /* add a new entry */
-    entry = malloc(sizeof(struct hashitem_s));
-    if(!entry)
+    entry = new_hash_item(table, key, hash);
+    if(entry)
     {
-        PRINT_ERROR("%s: failed to malloc hashtable item\n", SOURCE_NAME);
-        return NULL;
+        entry->refs = value;
     }
-    /* initialize it */
-    memset(entry, 0, sizeof(struct hashitem_s));
-    entry->name = __get_malloced_str(key);
-    entry->refs = value;
-    /*
-     * We are acting on the premise that a newly added variable
-     * is bound to be accessed sooner than later, this is why we
-     * add the new variable to the start of the linked list for 
-     * that bucket. Think about it, when you declare a variable,
-     * you are probably going to use it soon, right? Or maybe wrong,
-     * but this is how we do it here :)
-     */
-    int index = calc_hash(table, key);
-    entry->next = table->items[index];
-    table->items[index] = entry;
-    table->used++;
     /* return the new entry */
     return entry;
 }
 
 
 /*
- * Search for a string in a symbol table.
+ * Search for a string in the linked list of the given bucket. We compare the
+ * hashes first, and only compare the strings if the hashes match.
  * Returns the entry for the given string, or NULL if its not found.
  */
-struct hashitem_s *get_hash_item(struct hashtab_s *table, char *key)
+static inline struct hashitem_s *find_in_bucket(struct hashitem_s *entry, char *key, uint32_t hash)
 {
-    if(!table || !key)
-    {
-        return NULL;
-    }
-    /* hash the string */
-    int index = calc_hash(table, key);
-    /* get the table's bucket */
-    struct hashitem_s *entry = table->items[index];
     /* search the bucket's linked list for the string */
     while(entry)
     {
         /* found the string */
-        if(is_same_str(entry->name, key))
+        if(entry->hash == hash && is_same_str(entry->name, key))
         {
             return entry;
         }
@@ -386,6 +564,44 @@ struct hashitem_s *get_hash_item(struct hashtab_s *table, char *key)
 }
 
 
+/*
+ * Search for a string, whose hash is passed in the 'hash' parameter, in a
+ * hash table. Returns the entry for the given string, or NULL if its not found.
+ */
+struct hashitem_s *get_hash_itemh(struct hashtab_s *table, char *key, uint32_t hash)
+{
+    if(!table || !key || !table->items)
+    {
+        return NULL;
+    }
+    struct hashitem_s *entry = find_in_bucket(table->items[hash % table->size], key, hash);
+    /*
+     * If the table is being resized, the string might still be in the old
+     * buckets array.
+     */
+    if(!entry && table->old_items)
+    {
+        entry = find_in_bucket(table->old_items[hash % table->old_size], key, hash);
+    }
+    return entry;
+}
+
+
+/*
+ * Search for a string in a symbol table.
+ * Returns the entry for the given string, or NULL if its not found.
+ */
+struct hashitem_s *get_hash_item(struct hashtab_s *table, char *key)
+{
+    if(!table || !key)
+    {
+        return NULL;
+    }
+    /* hash the string and search the table's bucket */
+    return get_hash_itemh(table, key, calc_hash(key));
+}
+
+
 /*
  * Dump a string hash table, by printing the symbols, their keys and values.
  * Useful for debugging (but not currently used by the shell).
@@ -396,6 +612,7 @@ void dump_hashtable(struct hashtab_s *table, char *format)
     {
         format = "%s=%s\n";
     }
+    finish_hash_rehash(table);
     if(table->used)
     {
         struct hashitem_s **h1 = table->items;
@@ -22,11 +22,20 @@
 #ifndef STRING_HASH_H
 #define STRING_HASH_H
 
+#include <stdint.h>
+
 
 #ifndef HASHTABLE_INIT_SIZE
 #define HASHTABLE_INIT_SIZE     256     /* initial size of the string buffer */
 #endif
 
+/* hash table resizing parameters (see symtab_hash.h) */
+#ifndef HASHTABLE_MAX_LOAD
+#define HASHTABLE_MAX_LOAD      1       /* grow when entries/buckets > this */
+#define HASHTABLE_MIN_LOAD      8       /* shrink when buckets/entries > this */
+#define HASHTABLE_REHASH_STEP   4       /* buckets to rehash per operation */
+#endif
+
 /* the structure to hold a hashed string */
 struct hashitem_s
 {
@@ -40,6 +49,7 @@ struct hashitem_s
                                  */
     };
     struct  hashitem_s *next;   /* pointer to the next item */
+    uint32_t hash;              /* full hash of the key string */
 };
 
 /* string hash table structure */
@@ -48,6 +58,10 @@ struct hashtab_s
     int     size;               /* maximum number of buckets */
     int     used;               /* number of used buckets */
     struct  hashitem_s **items; /* the buckets array */
+    int     min_size;           /* we don't shrink the table below this size */
+    int     old_size;           /* number of buckets in the old buckets array */
+    int     rehash_index;       /* next old bucket to be rehashed */
+    struct  hashitem_s **old_items; /* old buckets array, NULL if not resizing */
 };
 
 struct hashtab_s *new_hashtable(void);
@@ -56,8 +70,13 @@ void   free_hashtable(struct hashtab_s *table);
 void   rem_all_items (struct hashtab_s *table, int free_index);
 void   rem_hash_item (struct hashtab_s *table, char *key);
 struct hashitem_s *add_hash_item(struct hashtab_s *table, char *key, char *value);
+void   rem_hash_entry(struct hashtab_s *table, struct hashitem_s *entry);
 struct hashitem_s *add_hash_itemb(struct hashtab_s *table, char *key, long value);
+struct hashitem_s *add_hash_itemh(struct hashtab_s *table, char *key, uint32_t hash, long value);
 struct hashitem_s *get_hash_item(struct hashtab_s *table, char *key);
+struct hashitem_s *get_hash_itemh(struct hashtab_s *table, char *key, uint32_t hash);
+uint32_t calc_hash(char *text);
 void   dump_hashtable(struct hashtab_s *table, char *format);
+void   finish_hash_rehash(struct hashtab_s *table);
 
 #endif
@@ -22,6 +22,8 @@
 #ifndef SYMTAB_H
 #define SYMTAB_H
 
+#include <stdint.h>
+
 /*
  * Use hash tables to implement the symbol table struct. Remove this macro,
  * or set it to 0 if you want to use the linked lists implementation instead.
@@ -44,6 +46,7 @@ struct symtab_entry_s
     unsigned  int flags;              /* flags like readonly, export, ... */
     struct    symtab_entry_s *next;   /* pointer to the next entry */
     struct    node_s *func_body;      /* for functions, the nodetree of the function body */
+    uint32_t  hash;                   /* full hash of the key (used by symtab_hash.c) */
 };
 
 
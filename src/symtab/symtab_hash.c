@@ -31,6 +31,9 @@
 
 struct symtab_stack_s symtab_stack;     /* the symbol tables stack */
 int    symtab_level;                    /* current level in the stack */
+struct symtab_pool_s  symtab_pool;      /* recycled (empty) symbol tables */
+struct symtab_lookup_cache_s symtab_lookup_cache;   /* get_symtab_entry() results */
+unsigned long symtab_generation;        /* generation number of the last pushed table */
 
 /*
  * We will use FNV-1a hashing. The following variables and functions implement
@@ -42,19 +45,16 @@ extern uint32_t fnv1a_hash_byte(unsigned char b, uint32_t hash);
 extern uint32_t fnv1a(char *text, uint32_t hash);
 
 /*
- * Calculate (hash) a string of text to obtain the index of its bucket in the
- * hash table. Returns the hashed index.
+ * Calculate (hash) a string of text. The full hash is stored in the symbol
+ * table entry, and the index of the entry's bucket in the hash table is the
+ * hash modulo the table's size. Returns the hash.
  * 
  * TODO: If you want to use another hashing algorithm, change the function
  *       call to fnv1a() to any other function of your liking.
  */
-uint32_t calc_symhash(struct symtab_s *table, char *text)
+static inline uint32_t calc_symhash(char *text)
 {
-    if(!table || !text)
-    {
-        return 0;
-    }
-    return fnv1a(text, fnv1a_seed) % table->size;
+    return fnv1a(text, fnv1a_seed);
 }
 
 /*****************************************
@@ -62,29 +62,170 @@ uint32_t calc_symhash(struct symtab_s *table, char *text)
  *****************************************/
 
 /*
- * Allocate a new hash table and initialize its structure.
-
+ * Allocate a new hash table and initialize its structure. If the pool of
+ * recycled tables is not empty, we take a table from the pool instead of
+ * calling malloc(). The bucket list is not allocated here, it is allocated
+ * when the first entry is added to the table (see alloc_hash_buckets() below).
+ *
  * Returns the table struct, or exits the shell in error if the table
  * could not be allocated.
  */
 struct symtab_s *alloc_hash_table(void)
 {
-    struct symtab_s *table = malloc(sizeof(struct symtab_s));
+    struct symtab_s *table;
+    if(symtab_pool.count)
+    {
+        /* pooled tables are already empty */
+        table = symtab_pool.tables[--symtab_pool.count];
+        symtab_pool.tables[symtab_pool.count] = NULL;
+        symtab_pool.hits++;
+        return table;
+    }
+    symtab_pool.misses++;
+    table = malloc(sizeof(struct symtab_s));
     if(!table)
     {
         exit_gracefully(EXIT_FAILURE, "fatal error: not enough memory for allocating the symbol table");
     }
     table->size  = HASHTABLE_INIT_SIZE;     /* start with default table size */
     table->used  = 0;                       /* empty buckets list */
-    size_t itemsz = HASHTABLE_INIT_SIZE * sizeof(struct symtab_entry_s *);
+    table->items = NULL;                    /* no buckets until we need them */
+    table->old_size     = 0;                /* we are not resizing */
+    table->rehash_index = 0;
+    table->old_items    = NULL;
+    return table;
+}
+
+
+/*
+ * Allocate the bucket list of a hash table, if it hasn't been allocated yet.
+ * Doesn't return if there is an error, the shell exits instead.
+ */
+static inline void alloc_hash_buckets(struct symtab_s *table)
+{
+    if(table->items)
+    {
+        return;
+    }
+    size_t itemsz = table->size * sizeof(struct symtab_entry_s *);
     table->items = malloc(itemsz);          /* alloc space for buckets */
     if(!table->items)
     {
-        free(table);
         exit_gracefully(EXIT_FAILURE, "fatal error: not enough memory for allocating the symbol table");
     }
     memset(table->items, 0, itemsz);        /* init buckets list */
-    return table;
+}
+
+
+/*
+ * Move the entries of up to 'count' non-empty buckets from the old bucket list
+ * of a table that is being resized to the new bucket list. We also limit the
+ * number of empty buckets we visit, so that a sparse old list doesn't make a
+ * single add or remove operation take too long. When all the old buckets have
+ * been moved, the old bucket list is freed.
+ */
+static void symtab_rehash_step(struct symtab_s *table, int count)
+{
+    if(!table->old_items)
+    {
+        return;
+    }
+    int visits = count * 10;
+    while(count > 0 && visits-- > 0 && table->rehash_index < table->old_size)
+    {
+        struct symtab_entry_s *entry = table->old_items[table->rehash_index];
+        if(entry)
+        {
+            count--;
+        }
+        /* move the bucket's entries to their new buckets */
+        while(entry)
+        {
+            struct symtab_entry_s *next = entry->next;
+            int index = entry->hash % table->size;
+            entry->next = table->items[index];
+            table->items[index] = entry;
+            entry = next;
+        }
+        table->old_items[table->rehash_index++] = NULL;
+    }
+    /* all old buckets moved. we're done resizing */
+    if(table->rehash_index >= table->old_size)
+    {
+        free(table->old_items);
+        table->old_items    = NULL;
+        table->old_size     = 0;
+        table->rehash_index = 0;
+    }
+}
+
+
+/*
+ * If the given table is being resized, move all the remaining buckets from
+ * the old bucket list to the new one. This should be called before iterating
+ * through the table's bucket list.
+ */
+void finish_symtab_rehash(struct symtab_s *table)
+{
+    if(table && table->old_items)
+    {
+        symtab_rehash_step(table, table->old_size);
+    }
+}
+
+
+/*
+ * Resize a table to the given number of buckets. The entries are not moved
+ * here, they are moved gradually by symtab_rehash_step() on the following
+ * add and remove operations. If we fail to alloc memory for the new bucket
+ * list, we silently keep the current list.
+ */
+static void symtab_resize(struct symtab_s *table, int newsize)
+{
+    /* finish any resizing that is still in progress */
+    finish_symtab_rehash(table);
+    size_t itemsz = newsize * sizeof(struct symtab_entry_s *);
+    struct symtab_entry_s **items = malloc(itemsz);
+    if(!items)
+    {
+        return;
+    }
+    memset(items, 0, itemsz);
+    table->old_items    = table->items;
+    table->old_size     = table->size;
+    table->rehash_index = 0;
+    table->items        = items;
+    table->size         = newsize;
+    symtab_rehash_step(table, HASHTABLE_REHASH_STEP);
+}
+
+
+/*
+ * Return a pointer to the pool of recycled symbol tables.
+ */
+struct symtab_pool_s *get_symtab_pool(void)
+{
+    return &symtab_pool;
+}
+
+
+/*
+ * Return a pointer to the symbol lookup cache.
+ */
+struct symtab_lookup_cache_s *get_symtab_lookup_cache(void)
+{
+    return &symtab_lookup_cache;
+}
+
+
+/*
+ * Invalidate the lookup cache slot of the given hash. Called when an entry is
+ * added to, or removed from, a symbol table, as this might change the result
+ * of looking up this entry's name.
+ */
+static inline void invalidate_lookup_slot(uint32_t hash)
+{
+    symtab_lookup_cache.slots[hash & (SYMTAB_LOOKUP_CACHE_SIZE-1)].entry = NULL;
 }
 
 
@@ -101,6 +242,8 @@ void init_symtab(void)
     symtab_stack.global_symtab  = table;
     symtab_stack.local_symtab   = table;
     symtab_stack.symtab_list[0] = table;
+    table->serial = ++symtab_generation;
+    symtab_lookup_cache.epoch++;
 }
 
 
@@ -125,6 +268,20 @@ void symtab_stack_add(struct symtab_s *symtab)
 {
     symtab_stack.symtab_list[symtab_stack.symtab_count++] = symtab;
     symtab_stack.local_symtab = symtab;
+    /*
+     * Give the table a new generation number, so that cache slots filled
+     * from a previous use of this table (we recycle tables) are not used.
+     */
+    symtab->serial = ++symtab_generation;
+    /*
+     * A table that already has entries might hide entries in the tables
+     * below it, so we invalidate the whole lookup cache. An empty table
+     * (the common case) can't change the result of any lookup.
+     */
+    if(symtab->used)
+    {
+        symtab_lookup_cache.epoch++;
+    }
 }
 
 
@@ -176,14 +333,17 @@ struct symtab_s *symtab_stack_pop(void)
 /*
  * Release the memory used to store a symbol table structure, as well as the
  * memory used to store the strings of key/value pairs we have stored in
- * the table.
+ * the table. If there is room in the pool of recycled tables, the emptied
+ * table is added to the pool instead of being freed.
  */
 void free_symtab(struct symtab_s *symtab)
 {
-    if(!symtab || !symtab->items)
+    if(!symtab)
     {
         return;
     }
+    /* get all entries in one bucket list */
+    finish_symtab_rehash(symtab);
     /* check if there are used buckets in the hash table */
     if(symtab->used)
     {
@@ -216,10 +376,30 @@ void free_symtab(struct symtab_s *symtab)
                 free(entry);
                 entry = next;
             }
+            /* empty the bucket, in case we recycle the table */
+            *h1 = NULL;
         }
+        symtab->used = 0;
+    }
+    /* a table that has grown goes back to the default size */
+    if(symtab->items && symtab->size != HASHTABLE_INIT_SIZE)
+    {
+        free(symtab->items);
+        symtab->items = NULL;
+        symtab->size  = HASHTABLE_INIT_SIZE;
+    }
+    /* keep the (now empty) table for later reuse, if we can */
+    if(symtab_pool.count < SYMTAB_POOL_SIZE)
+    {
+        symtab->level = 0;
+        symtab_pool.tables[symtab_pool.count++] = symtab;
+        return;
     }
     /* free the buckets list */
-    free(symtab->items);
+    if(symtab->items)
+    {
+        free(symtab->items);
+    }
     /* and the symbol table itself */
     free(symtab);
 }
@@ -246,6 +426,10 @@ struct symtab_entry_s *add_to_any_symtab(char *symbol, struct symtab_s *st)
     memset(entry, 0, sizeof(struct symtab_entry_s));
     /* get an malloc'd copy of the key string */
     entry->name = get_malloced_str(symbol);
+    /* hash the key once, we won't need to hash it again */
+    entry->hash = calc_symhash(symbol);
+    /* make sure the table has a bucket list */
+    alloc_hash_buckets(st);
     /*
      * We are acting on the premise that a newly added variable
      * is bound to be accessed sooner than later, this is why we
@@ -254,23 +438,32 @@ struct symtab_entry_s *add_to_any_symtab(char *symbol, struct symtab_s *st)
      * you are probably going to use it soon, right? Or maybe wrong,
      * but this is how we do it here :)
      */
-    int index = calc_symhash(st, symbol);
+    int index = entry->hash % st->size;
     entry->next = st->items[index];
     st->items[index] = entry;
     st->used++;
+    /* the new entry might hide an entry with the same name in a lower level */
+    invalidate_lookup_slot(entry->hash);
+    /* continue resizing the table, or grow it if it's getting crowded */
+    if(st->old_items)
+    {
+        symtab_rehash_step(st, HASHTABLE_REHASH_STEP);
+    }
+    else if(st->used > st->size * HASHTABLE_MAX_LOAD)
+    {
+        symtab_resize(st, st->size << 1);
+    }
     return entry;
 }
 
 
 /*
- * Remove an entry from a symbol table, given pointers to the entry and the
- * symbol table.
+ * Unlink an entry from the given bucket's linked list.
+ * Returns 1 if the entry was found in the bucket, 0 otherwise.
  */
-int rem_from_symtab(struct symtab_entry_s *entry, struct symtab_s *symtab)
+static int rem_from_bucket(struct symtab_entry_s *entry, struct symtab_entry_s **bucket)
 {
-    /* calc the key hash and get the table's bucket */
-    int index = calc_symhash(symtab, entry->name);
-    struct symtab_entry_s *e = symtab->items[index];
+    struct symtab_entry_s *e = *bucket;
     struct symtab_entry_s *p = NULL;
     /*
      * As the bucket can contain more than one entry, our target entry can
@@ -282,34 +475,18 @@ int rem_from_symtab(struct symtab_entry_s *entry, struct symtab_s *symtab)
         if(e == entry)
         {
             /*
-             * If this is the first item in the list, adjust the table
+             * If this is the first item in the list, adjust the bucket
              * pointer to point to the next item. Otherwise, ajust
              * the previous item's pointer to point to the next item.
              */
             if(!p)
             {
-                symtab->items[index] = e->next;
+                *bucket = e->next;
             }
             else
             {
                 p->next = e->next;
             }
-            /* free the memory used by this entry's value */
-            if(entry->val)
-            {
-                free_malloced_str(entry->val);
-            }
-            /* if it's a function, free the function body */
-            if(entry->func_body)
-            {
-                free_node_tree(entry->func_body);
-            }
-            /* free the key string */
-            free_malloced_str(entry->name);
-            /* free the entry itself */
-            free(entry);
-            /* decrement the count of used entries in the table */
-            symtab->used--;
             return 1;
         }
         /* check the next entry */
@@ -320,6 +497,71 @@ int rem_from_symtab(struct symtab_entry_s *entry, struct symtab_s *symtab)
 }
 
 
+/*
+ * Remove an entry from a symbol table, given pointers to the entry and the
+ * symbol table.
+ */
+int rem_from_symtab(struct symtab_entry_s *entry, struct symtab_s *symtab)
+{
+    /* empty table (no buckets yet) */
+    if(!symtab->items)
+    {
+        return 0;
+    }
+    /*
+     * If the table is being resized, the entry might still be in the old
+     * bucket list. Check there first.
+     */
+    struct symtab_entry_s **bucket = NULL;
+    if(symtab->old_items)
+    {
+        bucket = &symtab->old_items[entry->hash % symtab->old_size];
+        if(!rem_from_bucket(entry, bucket))
+        {
+            bucket = NULL;
+        }
+    }
+    /* get the table's bucket using the entry's hash */
+    if(!bucket)
+    {
+        bucket = &symtab->items[entry->hash % symtab->size];
+        if(!rem_from_bucket(entry, bucket))
+        {
+            return 0;
+        }
+    }
+    /* the cache might have a pointer to this entry */
+    invalidate_lookup_slot(entry->hash);
+    /* free the memory used by this entry's value */
+    if(entry->val)
+    {
+        free_malloced_str(entry->val);
+    }
+    /* if it's a function, free the function body */
+    if(entry->func_body)
+    {
+        free_node_tree(entry->func_body);
+    }
+    /* free the key string */
+    free_malloced_str(entry->name);
+    /* free the entry itself */
+    free(entry);
+    /* decrement the count of used entries in the table */
+    symtab->used--;
+    /* continue resizing the table, or shrink it if it has emptied out */
+    if(symtab->old_items)
+    {
+        symtab_rehash_step(symtab, HASHTABLE_REHASH_STEP);
+    }
+    else if(symtab->size > HASHTABLE_INIT_SIZE &&
+            symtab->used * HASHTABLE_MIN_LOAD < symtab->size)
+    {
+        symtab_resize(symtab, symtab->size >> 1);
+    }
+    return 1;
+}
+
+
 /*
  * Remove an entry from any symbol table in the stack.
  */
@@ -378,54 +620,98 @@ struct symtab_entry_s *add_to_symtab(char *symbol)
 
 
 /*
- * Search for a string in a symbol table.
+ * Search for a string in the linked list of the given bucket. We compare the
+ * hashes first, and only compare the strings if the hashes match.
  * Returns the entry for the given string, or NULL if its not found.
  */
-struct symtab_entry_s *do_lookup(char *str, struct symtab_s *symtab)
+static inline struct symtab_entry_s *find_in_bucket(struct symtab_entry_s *entry, char *str, uint32_t hash)
 {
-    if(!str || !symtab)
-    {
-        return NULL;
-    }
-    /* hash the key string */
-    int index = calc_symhash(symtab, str);
-    struct symtab_entry_s *entry = symtab->items[index];
     /* search the bucket's linked list for our string */
     while(entry)
     {
         /* found the string */
-        if(is_same_str(entry->name, str))
+        if(entry->hash == hash && is_same_str(entry->name, str))
         {
-            /* if special or numeric var, update the var's value */
-            char *val = NULL;
-            if(flag_set(entry->flags, FLAG_SPECIAL_VAR))
-            {
-                val = get_special_var(entry->name, entry->val);
-            }
-
-            /*
-            if(flag_set(entry->flags, FLAG_INTVAL) && entry->val)
-            {
-                val = arithm_expand(entry->val);
-            }
-            */
-            
-            if(val)
-            {
-                free_malloced_str(entry->val);
-                entry->val = get_malloced_str(val);
-                free(val);
-            }
-            
             return entry;
         }
         /* no match. check the next entry in the bucket */
         entry = entry->next;
     }
-    /* string not found in the table. return NULL */
+    /* string not found in the bucket. return NULL */
     return NULL;
 }
 
+
+/*
+ * If the given entry is a special or numeric var, update the var's value.
+ */
+static inline void update_special_var(struct symtab_entry_s *entry)
+{
+    char *val = NULL;
+    if(flag_set(entry->flags, FLAG_SPECIAL_VAR))
+    {
+        val = get_special_var(entry->name, entry->val);
+    }
+
+    /*
+    if(flag_set(entry->flags, FLAG_INTVAL) && entry->val)
+    {
+        val = arithm_expand(entry->val);
+    }
+    */
+    
+    if(val)
+    {
+        free_malloced_str(entry->val);
+        entry->val = get_malloced_str(val);
+        free(val);
+    }
+}
+
+
+/*
+ * Search for a string, whose hash is passed in the 'hash' parameter, in a
+ * symbol table. Returns the entry for the given string, or NULL if its not found.
+ */
+static struct symtab_entry_s *do_lookup_hashed(char *str, struct symtab_s *symtab, uint32_t hash)
+{
+    if(!symtab->items)
+    {
+        return NULL;
+    }
+    struct symtab_entry_s *entry = find_in_bucket(symtab->items[hash % symtab->size], str, hash);
+    /*
+     * If the table is being resized, the entry might still be in the old
+     * bucket list.
+     */
+    if(!entry && symtab->old_items)
+    {
+        entry = find_in_bucket(symtab->old_items[hash % symtab->old_size], str, hash);
+    }
+    /* string not found in the table. return NULL */
+    if(!entry)
+    {
+        return NULL;
+    }
+    update_special_var(entry);
+    return entry;
+}
+
+
+/*
+ * Search for a string in a symbol table.
+ * Returns the entry for the given string, or NULL if its not found.
+ */
+struct symtab_entry_s *do_lookup(char *str, struct symtab_s *symtab)
+{
+    if(!str || !symtab)
+    {
+        return NULL;
+    }
+    /* hash the key string */
+    return do_lookup_hashed(str, symtab, calc_symhash(str));
+}
+
 /*
  * Search for a string in the local symbol table.
  * Returns the entry for the given string, or NULL if its not found.
@@ -447,16 +733,45 @@ struct symtab_entry_s *get_local_symtab_entry(char *str)
  */
 struct symtab_entry_s *get_symtab_entry(char *str)
 {
+    if(!str)
+    {
+        return NULL;
+    }
+    /* hash the key once for all the tables */
+    uint32_t hash = calc_symhash(str);
+    /*
+     * Check the lookup cache first. The slot is only valid if the table we
+     * found the entry in is still where it was in the stack, and it's the
+     * same table (recycled tables get a new generation number).
+     */
+    struct symtab_lookup_s *slot = &symtab_lookup_cache.slots[hash & (SYMTAB_LOOKUP_CACHE_SIZE-1)];
+    if(slot->entry && slot->hash == hash && slot->epoch == symtab_lookup_cache.epoch &&
+       slot->depth < symtab_stack.symtab_count &&
+       symtab_stack.symtab_list[slot->depth] == slot->table &&
+       slot->table->serial == slot->serial && is_same_str(slot->entry->name, str))
+    {
+        symtab_lookup_cache.hits++;
+        update_special_var(slot->entry);
+        return slot->entry;
+    }
+    symtab_lookup_cache.misses++;
     int i = symtab_stack.symtab_count-1;
     do
     {
         /* start with the local symtab */
         struct symtab_s *symtab = symtab_stack.symtab_list[i];
         /* search for the key */
-        struct symtab_entry_s *entry = do_lookup(str, symtab);
+        struct symtab_entry_s *entry = do_lookup_hashed(str, symtab, hash);
         /* entry found */
         if(entry)
         {
+            /* remember where we found it */
+            slot->hash   = hash;
+            slot->depth  = i;
+            slot->serial = symtab->serial;
+            slot->epoch  = symtab_lookup_cache.epoch;
+            slot->table  = symtab;
+            slot->entry  = entry;
             return entry;
         }
     } while(--i >= 0);      /* move up one level */
@@ -577,6 +892,7 @@ void merge_global(struct symtab_s *symtab)
      * execution, in which case its symbol table is merged with the global symbol table.
      */
     int global_scope = (get_global_symtab() == symtab);
+    finish_symtab_rehash(symtab);
     if(symtab->used)
     {
         struct symtab_entry_s **h1 = symtab->items;
@@ -633,6 +949,7 @@ void dump_local_symtab(void)
     fprintf(stderr, "%*s===========================\n", indent, " ");
     fprintf(stderr, "%*s  No               Symbol                    Val\n", indent, " ");
     fprintf(stderr, "%*s------ -------------------------------- ------------\n", indent, " ");
+    finish_symtab_rehash(symtab);
     if(symtab->used)
     {
         struct symtab_entry_s **h1 = symtab->items;
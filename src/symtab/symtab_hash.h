@@ -25,13 +25,82 @@
 
 #define HASHTABLE_INIT_SIZE     256
 
+/*
+ * Hash tables grow (doubling their size) when the number of entries exceeds
+ * HASHTABLE_MAX_LOAD entries per bucket, and shrink (halving their size) when
+ * there are more than HASHTABLE_MIN_LOAD buckets per entry (we never shrink a
+ * table below HASHTABLE_INIT_SIZE though). Resizing is done incrementally, by
+ * moving HASHTABLE_REHASH_STEP buckets on every add and remove operation.
+ */
+#ifndef HASHTABLE_MAX_LOAD
+#define HASHTABLE_MAX_LOAD      1
+#define HASHTABLE_MIN_LOAD      8
+#define HASHTABLE_REHASH_STEP   4
+#endif
+
+/* maximum number of empty symbol tables we keep around for reuse */
+#define SYMTAB_POOL_SIZE        32
+
+/* number of slots in the symbol lookup cache (must be a power of 2) */
+#define SYMTAB_LOOKUP_CACHE_SIZE    64
+
 
 struct symtab_s
 {
     int    level;       /* table level (in the stack) */
     int    size;        /* total # of buckets */
     int    used;        /* # of used buckets */
-    struct symtab_entry_s **items;  /* the bucket list (pun intended) */
+    struct symtab_entry_s **items;  /*
+                                     * the bucket list (pun intended), alloc'd
+                                     * when the first entry is added to the table
+                                     */
+    /* the following fields are used when resizing the table */
+    int    old_size;                /* # of buckets in the old bucket list */
+    int    rehash_index;            /* next old bucket to be rehashed */
+    struct symtab_entry_s **old_items;  /* old bucket list, NULL if not resizing */
+    unsigned long serial;           /* generation number given when pushed on the stack */
+};
+
+/*
+ * Pool of empty symbol tables. Every simple command pushes a symbol table
+ * and pops it when it's done, so instead of freeing the popped table, we keep
+ * it (and its bucket list) in this pool, so that we can reuse it later.
+ */
+struct symtab_pool_s
+{
+    int    count;                               /* # of tables in the pool */
+    struct symtab_s *tables[SYMTAB_POOL_SIZE];  /* the pooled tables */
+    long   hits;                                /* # of tables we got from the pool */
+    long   misses;                              /* # of tables we had to malloc */
 };
 
+/*
+ * Cache of the results of the symbol table stack walk in get_symtab_entry().
+ * Each slot remembers the entry we found for a name, and the table (and its
+ * position in the stack) where we found it. A slot is valid as long as the
+ * table is still in the same position in the stack, with the same generation
+ * number, and no entry with the same name was added or removed since.
+ */
+struct symtab_lookup_s
+{
+    uint32_t hash;                  /* hash of the entry's name */
+    int      depth;                 /* index of the table in the stack */
+    unsigned long serial;           /* generation number of the table */
+    unsigned long epoch;            /* cache epoch when the slot was filled */
+    struct symtab_s       *table;   /* the table that contains the entry */
+    struct symtab_entry_s *entry;   /* the entry, NULL if the slot is empty */
+};
+
+struct symtab_lookup_cache_s
+{
+    unsigned long epoch;            /* bumped to invalidate all slots */
+    struct symtab_lookup_s slots[SYMTAB_LOOKUP_CACHE_SIZE];
+    long   hits;                    /* # of lookups answered from the cache */
+    long   misses;                  /* # of lookups that walked the stack */
+};
+
+struct symtab_pool_s *get_symtab_pool(void);
+struct symtab_lookup_cache_s *get_symtab_lookup_cache(void);
+void   finish_symtab_rehash(struct symtab_s *table);
+
 #endif
@@ -30,7 +30,10 @@
 #include <pwd.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 #include "cmd.h"
 #include "builtins/builtins.h"
 #include "builtins/setx.h"
@@ -216,6 +219,11 @@ long extract_num(char *buf, int start, int end)
  */
 int is_name(char *str)
 {
+    /* the eof token has no text */
+    if(!str)
+    {
+        return 0;
+    }
     /* names start with alpha char or an underscore... */
     if(!isalpha(*str) && *str != '_')
     {
@@ -788,6 +796,7 @@ char *get_all_vars(char *prefix)
 #ifdef USE_HASH_TABLES
     
         /* if we are implementing symbol tables as hash tables */
+        finish_symtab_rehash(symtab);
         if(symtab->used)
         {
             struct symtab_entry_s **h1 = symtab->items;
@@ -866,6 +875,492 @@ char *get_all_vars(char *prefix)
 }
 
 
+/*
+ * Max number of commands (separated by newlines) and nested function calls we
+ * accept when running a command substitution in the shell process itself.
+ */
+#define CMDSUBST_MAX_CMDS       8
+#define CMDSUBST_MAX_DEPTH      4
+
+/* initial size of the buffer we read command substitution output into */
+#define CMDSUBST_BUF_SIZE       4096
+
+/* builtins that have no side effects on the shell, and can run in the shell process */
+static char *cmdsubst_safe_builtins[] =
+{
+    ":", "[", "[[", "echo", "false", "pwd", "test", "true", NULL
+};
+
+
+/*
+ * Check if the parameter whose name is the first len chars of name can be
+ * expanded in the shell process. We refuse variables that are modified when
+ * expanded (see special_var_names in vars.c), or have different values in
+ * subshells, and the tcsh ${<} extension, which reads from stdin.
+ *
+ * Returns 1 if the parameter is safe, 0 otherwise.
+ */
+static int cmdsubst_safe_param(char *name, size_t len)
+{
+    int i;
+
+    if(len == 0 || (len == 8 && strncmp(name, "SUBSHELL", 8) == 0))
+    {
+        return 0;
+    }
+
+    for(i = 0; i < special_var_count; i++)
+    {
+        if(strlen(special_var_names[i]) == len &&
+           strncmp(name, special_var_names[i], len) == 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*
+ * Return the length of the parameter name at the start of p, which is either a
+ * variable name, a positional parameter, or a special parameter. Positional
+ * parameters can have multi-digit names only inside braces.
+ */
+static size_t cmdsubst_param_name_len(char *p, int in_braces)
+{
+    size_t len = 0;
+
+    if(isalpha(*p) || *p == '_')
+    {
+        while(isalnum(p[len]) || p[len] == '_')
+        {
+            len++;
+        }
+    }
+    else if(isdigit(*p))
+    {
+        len = 1;
+        while(in_braces && isdigit(p[len]))
+        {
+            len++;
+        }
+    }
+    else if(*p && strchr("#?-$!@*", *p))
+    {
+        len = 1;
+    }
+    return len;
+}
+
+
+/*
+ * Check if the given command word can be expanded in the shell process without
+ * changing the shell's state or behaving differently than it would in a subshell.
+ * We walk the word, skipping quoted parts, and classify each parameter expansion
+ * by its name and operator. We refuse words with nested command substitutions,
+ * arithmetic expansions, process substitutions, parameter expansions that might
+ * assign to variables or exit the shell (anything but ${var}, ${#var} and the
+ * -, +, # and % operators), and unsafe parameters (see cmdsubst_safe_param()).
+ * With 'set -u', expanding an unset parameter exits the shell, so we refuse any
+ * parameter expansion.
+ *
+ * Returns 1 if the word is safe, 0 otherwise.
+ */
+static int cmdsubst_safe_word(char *word)
+{
+    char *p = word;
+    size_t len;
+    int in_double_quotes = 0;
+
+    while(*p)
+    {
+        switch(*p)
+        {
+            case '\\':
+                if(p[1])
+                {
+                    p++;
+                }
+                break;
+
+            case '\'':
+                if(!in_double_quotes)
+                {
+                    len = find_closing_quote(p, 0, 0);
+                    if(!len)
+                    {
+                        return 0;
+                    }
+                    p += len;
+                }
+                break;
+
+            case '"':
+                in_double_quotes = !in_double_quotes;
+                break;
+
+            case '`':
+                return 0;
+
+            case '<':
+            case '>':
+                if(p[1] == '(' && !in_double_quotes)
+                {
+                    return 0;
+                }
+                break;
+
+            case '$':
+                if(p[1] == '(' || p[1] == '[')
+                {
+                    return 0;
+                }
+
+                if(p[1] == '{')
+                {
+                    p += 2;
+                    /* ${#var} gives the length of var, ${!var} is indirection */
+                    if(*p == '#' && p[1] != '}' && !strchr("-=?+", p[1]))
+                    {
+                        p++;
+                    }
+                    else if(*p == '!' && p[1] != '}')
+                    {
+                        return 0;
+                    }
+
+                    len = cmdsubst_param_name_len(p, 1);
+                    if(option_set('u') || !cmdsubst_safe_param(p, len))
+                    {
+                        return 0;
+                    }
+                    p += len;
+
+                    /* the word after the operator is checked as we go on */
+                    if(*p == ':')
+                    {
+                        p++;
+                        if(*p != '-' && *p != '+')
+                        {
+                            return 0;
+                        }
+                    }
+                    else if(*p != '}' && !strchr("-+#%", *p))
+                    {
+                        return 0;
+                    }
+                    break;
+                }
+
+                len = cmdsubst_param_name_len(p+1, 0);
+                if(len && (option_set('u') || !cmdsubst_safe_param(p+1, len)))
+                {
+                    return 0;
+                }
+                p += len;
+                break;
+        }
+
+        if(*p)
+        {
+            p++;
+        }
+    }
+    return 1;
+}
+
+
+/*
+ * Check if the nodetree of a command substitution contains only commands that
+ * can run in the shell process without changing the shell's state, that is,
+ * lists and AND-OR lists of simple commands that call side effect-free builtins,
+ * or functions whose bodies (recursively) do the same. depth is the level of
+ * nested function calls.
+ *
+ * Returns 1 if the nodetree is safe, 0 otherwise.
+ */
+static int cmdsubst_safe_node(struct node_s *node, int depth)
+{
+    struct node_s *child;
+    switch(node->type)
+    {
+        case NODE_LIST:
+        case NODE_TERM:
+            /* asynchronous lists start a subshell */
+            if(node->val_type == VAL_CHR && node->val.chr == '&')
+            {
+                return 0;
+            }
+            __attribute__((fallthrough));
+            
+        case NODE_ANDOR:
+        case NODE_AND_IF:
+        case NODE_OR_IF:
+            for(child = node->first_child; child; child = child->next_sibling)
+            {
+                if(!cmdsubst_safe_node(child, depth))
+                {
+                    return 0;
+                }
+            }
+            return 1;
+
+        case NODE_COMMAND:
+            break;
+
+        default:
+            return 0;
+    }
+
+    /* no assignments or redirections, only words */
+    if(!node->first_child)
+    {
+        return 0;
+    }
+
+    for(child = node->first_child; child; child = child->next_sibling)
+    {
+        if(child->type != NODE_VAR || child->val_type != VAL_STR ||
+           !child->val.str || !cmdsubst_safe_word(child->val.str))
+        {
+            return 0;
+        }
+    }
+
+    char *name = node->first_child->val.str;
+    struct builtin_s *builtin = is_enabled_builtin(name);
+    struct symtab_entry_s *func = get_func(name);
+
+    if(builtin && !func)
+    {
+        /* return is safe inside function bodies */
+        if(depth && strcmp(name, "return") == 0)
+        {
+            return 1;
+        }
+
+        char **b;
+        for(b = cmdsubst_safe_builtins; *b; b++)
+        {
+            if(strcmp(*b, name) == 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if(func && !builtin && func->func_body && depth < CMDSUBST_MAX_DEPTH)
+    {
+        return cmdsubst_safe_node(func->func_body, depth+1);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Try to perform command substitution without forking a subshell, which is much
+ * more expensive than running the command itself when the command consists only
+ * of calls to builtins such as echo and pwd, or to functions that call such
+ * builtins (see cmdsubst_safe_node()). We parse the command, and if it's safe,
+ * we execute it with stdout redirected to a temp file. If the command
+ * might change the shell's state, if it runs external commands, or if it has
+ * a syntax error, we return NULL and the caller should fork a subshell to run
+ * (or report) the command.
+ *
+ * As in a subshell, aliases are not expanded, and the command's exit status
+ * doesn't change the value of $?.
+ *
+ * Returns the malloc'd output of the command, with trailing newlines removed,
+ * or NULL if the command can't be run in the shell process.
+ */
+static char *command_substitute_inline(char *cmd)
+{
+    /*
+     * errors with -e or -u would exit the shell, not the subshell. the DEBUG,
+     * ERR and RETURN traps are not inherited by subshells.
+     */
+    if(option_set('e') || option_set('u'))
+    {
+        return NULL;
+    }
+
+    char *traps[] = { "DEBUG", "ERR", "RETURN" };
+    size_t i;
+    for(i = 0; i < sizeof(traps)/sizeof(char *); i++)
+    {
+        struct trap_item_s *trap = get_trap_item(traps[i]);
+        if(trap && trap->action_str)
+        {
+            return NULL;
+        }
+    }
+
+    struct source_s src;
+    src.buffer   = cmd;
+    src.bufsize  = strlen(cmd);
+    src.srctype  = SOURCE_CMDSTR;
+    src.buftype  = SOURCE_BUF_BORROWED;
+    src.srcname  = NULL;
+    src.curpos   = INIT_SRC_POS;
+    src.curline  = 1;
+
+    struct token_s *old_current_token = dup_token(get_current_token());
+    struct token_s *old_previous_token = dup_token(get_previous_token());
+
+    /* subshells don't expand aliases (see init_subshell()) */
+    int expand_aliases = optionx_set(OPTION_EXPAND_ALIASES);
+    set_optionx(OPTION_EXPAND_ALIASES, 0);
+
+    /*
+     * parse the commands and check they are all safe to run in our process.
+     * this is a trial parse: if the command has a syntax error, we let the
+     * subshell report it (and exit), so we hold back error messages and make
+     * the parser jump back here instead of exiting the shell (see
+     * EXIT_IF_NONINTERACTIVE() in cmd.h).
+     */
+    static FILE  *errfile = NULL;
+    static char  *errbuf = NULL;
+    static size_t errbuf_size = 0;
+    struct node_s *cmds[CMDSUBST_MAX_CMDS];
+    volatile int count = 0;
+    int safe = 1, j;
+    FILE *saved_stderr = stderr;
+    int saved_tentative_parse = tentative_parse;
+    jmp_buf saved_env;
+    memcpy(saved_env, tentative_parse_env, sizeof(jmp_buf));
+
+    if(!errfile)
+    {
+        errfile = open_memstream(&errbuf, &errbuf_size);
+    }
+
+    if(!errfile)
+    {
+        safe = 0;
+    }
+    else if(setjmp(tentative_parse_env))
+    {
+        /* the partially parsed nodetree is lost in this case */
+        safe = 0;
+    }
+    else
+    {
+        rewind(errfile);
+        stderr = errfile;
+        tentative_parse = 1;
+        parser_err = 0;
+        skip_white_spaces(&src);
+        struct token_s *tok = tokenize(&src);
+        while(tok->type != TOKEN_EOF)
+        {
+            if(tok->type == TOKEN_COMMENT || tok->type == TOKEN_NEWLINE)
+            {
+                tok = tokenize(tok->src);
+                continue;
+            }
+
+            struct node_s *node = parse_list(tok);
+            if(parser_err || !node)
+            {
+                if(node)
+                {
+                    free_node_tree(node);
+                }
+                safe = 0;
+                break;
+            }
+
+            cmds[count++] = node;
+            if(count == CMDSUBST_MAX_CMDS || !cmdsubst_safe_node(node, 0))
+            {
+                safe = 0;
+                break;
+            }
+            tok = get_current_token();
+        }
+    }
+
+    stderr = saved_stderr;
+    tentative_parse = saved_tentative_parse;
+    memcpy(tentative_parse_env, saved_env, sizeof(jmp_buf));
+    parser_err = 0;
+
+    set_optionx(OPTION_EXPAND_ALIASES, expand_aliases);
+    
+    char *buf = NULL;
+    FILE *out = NULL;
+    int saved_stdout = -1;
+    
+    /*
+     * point fd 1 (not only the stdout stream) at a temp file while the commands
+     * run, so that builtins writing directly to fd 1, and tests such as
+     * '[ -t 1 ]', see the same thing they would see in a subshell.
+     */
+    if(safe && (out = tmpfile()))
+    {
+        fflush(stdout);
+        saved_stdout = dup(1);
+        if(saved_stdout >= 0 && dup2(fileno(out), 1) < 0)
+        {
+            close(saved_stdout);
+            saved_stdout = -1;
+        }
+    }
+
+    if(saved_stdout >= 0)
+    {
+        int saved_exit_status = exit_status;
+
+        for(j = 0; j < count; j++)
+        {
+            do_list(&src, cmds[j], NULL);
+        }
+        fflush(stdout);
+        dup2(saved_stdout, 1);
+        close(saved_stdout);
+        
+        set_internal_exit_status(saved_exit_status);
+
+        /* read back the output */
+        off_t bufsz = lseek(fileno(out), 0, SEEK_END);
+        if(bufsz >= 0 && (buf = malloc(bufsz+1)))
+        {
+            if(pread(fileno(out), buf, bufsz, 0) != bufsz)
+            {
+                bufsz = 0;
+            }
+            buf[bufsz] = '\0';
+
+            /* remove any trailing newlines */
+            while(bufsz && (buf[bufsz-1] == '\n' || buf[bufsz-1] == '\r'))
+            {
+                buf[--bufsz] = '\0';
+            }
+        }
+    }
+
+    if(out)
+    {
+        fclose(out);
+    }
+
+    for(j = 0; j < count; j++)
+    {
+        free_node_tree(cmds[j]);
+    }
+
+    /* restore the parser's state */
+    free_token(get_current_token());
+    free_token(get_previous_token());
+    set_current_token(old_current_token);
+    set_previous_token(old_previous_token);
+
+    return buf;
+}
+
+
 /*
  * Perform command substitutions.
  * The backquoted flag tells if we are called from a backquoted command substitution:
@@ -881,8 +1376,6 @@ char *command_substitute(char *orig_cmd)
     char    b[1024];
     size_t  bufsz = 0;
     char   *buf   = NULL;
-    char   *p     = NULL;
-    int     i     = 0;
     int backquoted = (*orig_cmd == '`');
 
     /* 
@@ -935,6 +1428,7 @@ char *command_substitute(char *orig_cmd)
     }
 
     FILE *fp = NULL;
+    int fd = -1;
     if(!backquoted && cmd2[0] == '<')
     {
         /*
@@ -948,9 +1442,15 @@ char *command_substitute(char *orig_cmd)
         }
         if(!*cmd)
         {
+            free(cmd2);
             return NULL;
         }
-        fp = fopen(cmd, "r");
+
+        /*
+         * we don't need stdio's buffering, as we read the file directly into the
+         * result buffer, which we size exactly using fstat() (see below).
+         */
+        fd = open(cmd, O_RDONLY | O_CLOEXEC);
     }
     else if(!backquoted && isdigit(cmd2[0]))
     {
@@ -995,45 +1495,74 @@ char *command_substitute(char *orig_cmd)
     }
     else
     {
+        /* run builtin-only commands without forking a subshell */
+        if((buf = command_substitute_inline(cmd2)))
+        {
+            free(cmd2);
+            return buf;
+        }
+        
         /*
          * open a pipe for all other (normal) commands.
          */
         fp = popenr(cmd2);
         //fp = popen(cmd2, "r");
     }
+
+    if(fp)
+    {
+        fd = fileno(fp);
+    }
+
     /* check if we have opened the pipe */
-    if(!fp)
+    if(fd < 0)
     {
         free(cmd2);
         PRINT_ERROR("%s: failed to open pipe: %s\n", SOURCE_NAME, strerror(errno));
         return NULL;
     }
 
-    /* read the command output */
-    while(!feof(fp))
+    /*
+     * read the command output directly from the file descriptor in large chunks,
+     * growing the buffer geometrically. if we know the size of the output (when
+     * reading a regular file in the $(<file) case), or the pipe has data waiting
+     * to be read, we size the buffer accordingly to avoid extra reallocs.
+     */
+    int avail = 0;
+    size_t bufcap = CMDSUBST_BUF_SIZE;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
     {
-        i = fread(b, 1, 1024, fp);
-        if(i == 0)
+        /* add 1 so that we read EOF without extending the buffer */
+        if((size_t)st.st_size >= bufcap)
         {
-            continue;
+            bufcap = st.st_size+1;
         }
-        
-        /* first time. alloc buffer */
-        if(!buf)
+    }
+    else if(ioctl(fd, FIONREAD, &avail) == 0 && (size_t)avail > bufcap)
+    {
+        bufcap = avail;
+    }
+
+    /* add 1 for the null terminating byte */
+    buf = malloc(bufcap+1);
+    if(!buf)
+    {
+        goto fin;
+    }
+
+    while(1)
+    {
+        /* extend buffer */
+        if(bufsz == bufcap)
         {
-            /* add 1 for the null terminating byte */
-            buf = malloc(i+1);
-            if(!buf)
+            size_t newcap = bufcap*2;
+            if(ioctl(fd, FIONREAD, &avail) == 0 && bufsz+avail > newcap)
             {
-                goto fin;
+                newcap = bufsz+avail;
             }
-            p   = buf;
-        }
-        /* extend buffer */
-        else
-        {
-            char *buf2 = realloc(buf, bufsz+i+1);
-            //if(buf != buf2) free(buf);
+
+            char *buf2 = realloc(buf, newcap+1);
             if(!buf2)
             {
                 free(buf);
@@ -1041,40 +1570,39 @@ char *command_substitute(char *orig_cmd)
                 goto fin;
             }
             buf = buf2;
-            p   = buf+bufsz;
+            bufcap = newcap;
+        }
+
+        ssize_t n = read(fd, buf+bufsz, bufcap-bufsz);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
         }
-        bufsz += i;
-        /* copy the input and add the null terminating byte */
-        memcpy(p, b, i);
-        p[i] = '\0';
+
+        if(n <= 0)
+        {
+            break;
+        }
+        bufsz += n;
     }
 // #include <signal.h>
 //     raise(SIGTSTP);
 
-    if(!bufsz)
+    /* remove any trailing newlines */
+    while(bufsz && (buf[bufsz-1] == '\n' || buf[bufsz-1] == '\r'))
     {
-        /* command returned empty result */
-        buf = __get_malloced_str("");
-    }
-    else
-    {
-        /* remove any trailing newlines */
-        i = bufsz-1;
-        while(buf[i] == '\n' || buf[i] == '\r')
-        {
-            buf[i] = '\0';
-            i--;
-        }
+        bufsz--;
     }
+    buf[bufsz] = '\0';
     
 fin:
-    if(cmd2[0] == '<')
+    if(fp)
     {
-        fclose(fp);
+        pclose(fp);
     }
     else
     {
-        pclose(fp);
+        close(fd);
     }
     
     /* free used memory */